@@ -0,0 +1,678 @@
+#include <iostream>
+#include <utility>
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdio>
+
+#include "bst.hpp"
+#include "frozen_bst.hpp"
+#include "wide_bst.hpp"
+#include "pool_allocator.hpp"
+#include "mapped_bst.hpp"
+#include "wal.hpp"
+
+/*
+*Benchmarks of the tree operations.
+*Each benchmark prints the average time per operation in nanoseconds.
+*/
+
+//Time per iteration of f over n operations
+template <class F>
+double time_per_op(size_t n, F f){
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / n;
+}
+
+//Random keys in [0, 2n): about half of the lookups are hits
+std::vector<int> random_keys(size_t n, unsigned seed){
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> d(0, 2*n);
+    std::vector<int> v(n);
+    for(auto& x : v)
+        x = d(rng);
+    return v;
+}
+
+/*
+****** 1. FIND: pointer based Bst vs FrozenBst ******
+*/
+void bench_frozen(size_t n){
+    Bst<int, int> tree;
+    for(int k : random_keys(n, 1))
+        tree.insert({k,k});
+    tree.balance();
+    FrozenBst<int, int> frozen{tree};
+
+    std::vector<int> lookups = random_keys(n, 2);
+    long found = 0;
+    double t_bst = time_per_op(n, [&]{
+        for(int k : lookups)
+            found += tree.find(k) != tree.end();
+    });
+    double t_frozen = time_per_op(n, [&]{
+        for(int k : lookups)
+            found += frozen.find(k) != frozen.end();
+    });
+    std::cout << "find, " << frozen.size() << " keys: Bst " << t_bst << " ns, FrozenBst " << t_frozen 
+              << " ns (" << found << " hits)" << std::endl;
+}
+
+/*
+****** 2. FIND: pointer based Bst vs WideBst ******
+*/
+void bench_wide(size_t n){
+    Bst<int, int, std::less<int>, avl_balanced> tree;
+    WideBst<int, int> wide;
+    for(int k : random_keys(n, 1)){
+        tree.insert({k,k});
+        wide.insert({k,k});
+    }
+
+    std::vector<int> lookups = random_keys(n, 2);
+    long found = 0;
+    double t_bst = time_per_op(n, [&]{
+        for(int k : lookups)
+            found += tree.find(k) != tree.end();
+    });
+    double t_wide = time_per_op(n, [&]{
+        for(int k : lookups)
+            found += wide.find(k) != wide.end();
+    });
+    std::cout << "find, " << wide.size() << " keys: Bst (AVL) " << t_bst << " ns, WideBst " << t_wide 
+              << " ns (" << found << " hits)" << std::endl;
+}
+
+/*
+****** 3. BATCH INSERT vs repeated insert ******
+*/
+void bench_batch(size_t n, size_t m){
+    std::vector<std::pair<int, int>> initial;
+    for(int k : random_keys(n, 1))
+        initial.push_back({k,k});
+    std::vector<std::pair<int, int>> batch;
+    for(int k : random_keys(m, 3))
+        batch.push_back({k,k});
+
+    Bst<int, int, std::less<int>, avl_balanced> tree1;
+    tree1.insert_batch(initial);
+    Bst<int, int, std::less<int>, avl_balanced> tree2{tree1};
+
+    double t_insert = time_per_op(m, [&]{
+        for(const auto& x : batch)
+            tree1.insert(x);
+    });
+    double t_batch = time_per_op(m, [&]{
+        tree2.insert_batch(batch);
+    });
+    std::cout << "insert " << m << " keys into " << n << ": insert " << t_insert << " ns, insert_batch " << t_batch << " ns" << std::endl;
+}
+
+/*
+****** 4. FIND MANY vs a loop of find ******
+*/
+void bench_find_many(size_t n){
+    Bst<int, int, std::less<int>, avl_balanced> tree;
+    for(int k : random_keys(n, 1))
+        tree.insert({k,k});
+    using iterator = Bst<int, int, std::less<int>, avl_balanced>::iterator;
+
+    std::vector<int> lookups = random_keys(n, 2);
+    std::vector<iterator> its(n, tree.end());
+    long found = 0;
+    double t_find = time_per_op(n, [&]{
+        for(size_t i = 0; i < n; i++)
+            its[i] = tree.find(lookups[i]);
+    });
+    double t_many = time_per_op(n, [&]{
+        tree.find_many(lookups.begin(), lookups.end(), its.begin());
+    });
+    for(auto it : its)
+        found += it != tree.end();
+    std::cout << "lookup " << n << " keys: find " << t_find << " ns, find_many " << t_many 
+              << " ns (" << found << " hits)" << std::endl;
+}
+
+/*
+****** 5. FULL SCAN: parent pointers vs threaded links ******
+*/
+void bench_scan(size_t n){
+    Bst<int, int, std::less<int>, avl_balanced> tree;
+    Bst<int, int, std::less<int>, threaded<avl_balanced>> tree_threaded;
+    for(int k : random_keys(n, 1)){
+        tree.insert({k,k});
+        tree_threaded.insert({k,k});
+    }
+
+    long sum = 0;
+    double t_bst = time_per_op(tree.size(), [&]{
+        for(const auto& x : tree)
+            sum += x.second;
+    });
+    double t_threaded = time_per_op(tree.size(), [&]{
+        for(const auto& x : tree_threaded)
+            sum += x.second;
+    });
+    double t_reverse = time_per_op(tree.size(), [&]{
+        for(auto it = tree_threaded.crbegin(); it != tree_threaded.crend(); ++it)
+            sum += it->second;
+    });
+    std::cout << "scan " << tree.size() << " keys: Bst " << t_bst << " ns, threaded " << t_threaded 
+              << " ns, threaded reverse " << t_reverse << " ns (" << sum << ")" << std::endl;
+}
+
+/*
+****** 6. AGGREGATION: loop vs parallel_reduce ******
+*/
+void bench_parallel(size_t n){
+    Bst<int, long, std::less<int>, avl_balanced> tree;
+    for(int k : random_keys(n, 1))
+        tree.insert({k,k});
+
+    long sum = 0, parallel_sum = 0;
+    double t_loop = time_per_op(tree.size(), [&]{
+        for(const auto& x : tree)
+            sum += x.second;
+    });
+    double t_parallel = time_per_op(tree.size(), [&]{
+        parallel_sum = tree.parallel_reduce(0L, [](const std::pair<const int, long>& x){ return x.second; }, std::plus<long>());
+    });
+    std::cout << "sum " << tree.size() << " values: loop " << t_loop << " ns, parallel_reduce " << t_parallel 
+              << " ns on " << thread_pool::shared().size() << " threads (" << (sum == parallel_sum ? "same" : "different") << " result)" << std::endl;
+}
+
+/*
+****** 7. BUILD FROM UNSORTED PAIRS: insert vs build_parallel ******
+*/
+void bench_build(size_t n){
+    std::vector<std::pair<int, int>> pairs;
+    for(int k : random_keys(n, 1))
+        pairs.push_back({k,k});
+
+    Bst<int, int, std::less<int>, avl_balanced> tree1, tree2;
+    double t_insert = time_per_op(n, [&]{
+        for(const auto& x : pairs)
+            tree1.insert(x);
+    });
+    size_t threads = std::thread::hardware_concurrency();
+    double t_build = time_per_op(n, [&]{
+        tree2.build_parallel(pairs.begin(), pairs.end(), threads);
+    });
+    std::cout << "build from " << n << " pairs: insert " << t_insert << " ns, build_parallel " << t_build 
+              << " ns on " << threads << " threads" << std::endl;
+}
+
+/*
+****** 8. UNION: insert loop vs merge_union ******
+*/
+void bench_union(size_t n, size_t m){
+    Bst<int, int, std::less<int>, avl_balanced> tree1, tree2, other1, other2;
+    for(int k : random_keys(n, 1)){
+        tree1.insert({k,k});
+        tree2.insert({k,k});
+    }
+    std::vector<int> keys = random_keys(m, 2);
+    for(int k : keys){
+        if(other1.find(k) == other1.end()){
+            other1.insert({k,k});
+            other2.insert({k,k});
+        }
+    }
+
+    double t_insert = time_per_op(m, [&]{
+        for(const auto& x : other1)
+            if(tree1.find(x.first) == tree1.end())
+                tree1.insert(x);
+    });
+    double t_union = time_per_op(m, [&]{
+        tree2.merge_union(std::move(other2));
+    });
+    std::cout << "union of " << n << " and " << m << " keys: insert " << t_insert << " ns, merge_union " << t_union 
+              << " ns (" << (tree1.size() == tree2.size() ? "same" : "different") << " size)" << std::endl;
+}
+
+/*
+****** 9. STRING LOOKUP: std::string keys built for the lookups vs a transparent comparator ******
+*/
+//A key in a buffer (a string_view), compared with the std::string keys without copying it
+struct key_ref{
+    const char* data;
+    size_t size;
+};
+struct less_ref{
+    using is_transparent = void;
+    static int cmp(const char* a, size_t n, const char* b, size_t m){
+        int c = std::memcmp(a, b, std::min(n, m));
+        return c ? c : (n < m ? -1 : (n > m ? 1 : 0));
+    }
+    bool operator()(const std::string& a, const std::string& b) const { return a < b; }
+    bool operator()(const std::string& a, key_ref b) const { return cmp(a.data(), a.size(), b.data, b.size) < 0; }
+    bool operator()(key_ref a, const std::string& b) const { return cmp(a.data, a.size, b.data(), b.size()) < 0; }
+};
+
+void bench_transparent(size_t n){
+    Bst<std::string, int> tree;
+    Bst<std::string, int, less_ref> tree_transparent;
+    std::vector<std::string> names;
+    for(int k : random_keys(n, 1))
+        names.push_back("a key longer than the small string buffer " + std::to_string(k));
+    for(const auto& s : names){
+        tree.insert({s,1});
+        tree_transparent.insert({s,1});
+    }
+    std::vector<key_ref> lookups;
+    for(const auto& s : names)
+        lookups.push_back({s.data(), s.size()});
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937(2));
+
+    size_t hits = 0, hits_transparent = 0;
+    double t_plain = time_per_op(n, [&]{
+        for(key_ref s : lookups)
+            hits += tree.find(std::string(s.data, s.size)) != tree.end();
+    });
+    double t_transparent = time_per_op(n, [&]{
+        for(key_ref s : lookups)
+            hits_transparent += tree_transparent.find(s) != tree_transparent.end();
+    });
+    std::cout << "find " << n << " string keys: building std::string " << t_plain << " ns, transparent " << t_transparent 
+              << " ns (" << (hits == hits_transparent ? "same" : "different") << " hits)" << std::endl;
+}
+
+/*
+****** 10. DUPLICATE HEAVY STREAMS: insert and try_emplace, erase + insert vs extract + insert ******
+*/
+void bench_duplicates(size_t n){
+    std::vector<int> stream = random_keys(n, 1);
+    for(int& k : stream)
+        k %= n / 16 + 1;										//every key comes about 16 times
+    Bst<int, int, std::less<int>, avl_balanced> tree1, tree2;
+    double t_insert = time_per_op(n, [&]{
+        for(int k : stream)
+            tree1.insert({k,k});
+    });
+    double t_try = time_per_op(n, [&]{
+        for(int k : stream)
+            tree2.try_emplace(k, k);
+    });
+
+    Bst<int, int, std::less<int>, avl_balanced> from1{tree1}, from2{tree1}, to1, to2;
+    std::vector<int> keys;
+    for(const auto& x : tree1)
+        keys.push_back(x.first);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(2));
+    double t_erase = time_per_op(keys.size(), [&]{
+        for(int k : keys){
+            auto it = from1.find(k);
+            to1.insert(*it);
+            from1.erase(k);
+        }
+    });
+    double t_extract = time_per_op(keys.size(), [&]{
+        for(int k : keys)
+            to2.insert(from2.extract(k));
+    });
+    std::cout << n << " inserts of " << tree1.size() << " keys: insert " << t_insert << " ns, try_emplace " << t_try 
+              << " ns; move the keys to another tree: erase + insert " << t_erase << " ns, extract + insert " << t_extract << " ns" << std::endl;
+}
+
+/*
+****** 11. HINTED INSERT: insert vs insert with the previous position as hint ******
+*sequential: increasing keys; near-sequential: each key a few steps after the previous one,
+*not always in order; random: the hint never helps
+*/
+template <class Tree>
+void bench_hint_stream(const char* name, const std::vector<int>& keys){
+    Tree tree1, tree2, tree3;
+    double t_insert = time_per_op(keys.size(), [&]{
+        for(int k : keys)
+            tree1.insert({k,k});
+    });
+    double t_hint = time_per_op(keys.size(), [&]{
+        auto it = tree2.end();
+        for(int k : keys)
+            it = tree2.insert(it, {k,k});
+    });
+    double t_index = time_per_op(keys.size(), [&]{
+        for(int k : keys)
+            tree3[k] = k;
+    });
+    std::cout << "  " << name << ": insert " << t_insert << " ns, insert with hint " << t_hint << " ns, operator[] " << t_index << " ns" << std::endl;
+}
+
+void bench_hint(size_t n){
+    std::vector<int> sequential(n), near(n);
+    std::mt19937 rng(1);
+    for(size_t i = 0; i < n; i++){
+        sequential[i] = i;
+        near[i] = 4*i + rng() % 8;							//about one key in four comes before the previous one
+    }
+    std::vector<int> random = random_keys(n, 1);
+    std::cout << "insert " << n << " keys" << std::endl;
+    bench_hint_stream<Bst<int, int, std::less<int>, avl_balanced>>("avl, sequential", sequential);
+    bench_hint_stream<Bst<int, int, std::less<int>, avl_balanced>>("avl, near-sequential", near);
+    bench_hint_stream<Bst<int, int, std::less<int>, avl_balanced>>("avl, random", random);
+    bench_hint_stream<Bst<int, int, std::less<int>, threaded<avl_balanced>>>("threaded avl, sequential", sequential);
+    bench_hint_stream<Bst<int, int, std::less<int>, threaded<avl_balanced>>>("threaded avl, near-sequential", near);
+}
+
+/*
+****** 12. SKEWED LOOKUPS: avl_balanced vs splay_balanced under Zipf and uniform access ******
+*/
+//m keys among the n keys 0, 2, 4, ..., the i-th most frequent with probability proportional to 1/i^s;
+//the ranks are shuffled, so the hot keys are spread over the tree
+std::vector<int> zipf_keys(size_t n, size_t m, double s, unsigned seed){
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for(size_t i = 0; i < n; i++)
+        cdf[i] = (sum += 1.0 / std::pow(i + 1, s));
+    std::vector<int> key_of_rank(n);
+    for(size_t i = 0; i < n; i++)
+        key_of_rank[i] = 2*i;
+    std::mt19937 rng(seed);
+    std::shuffle(key_of_rank.begin(), key_of_rank.end(), rng);
+    std::uniform_real_distribution<double> d(0, sum);
+    std::vector<int> v(m);
+    for(auto& x : v)
+        x = key_of_rank[std::lower_bound(cdf.begin(), cdf.end(), d(rng)) - cdf.begin()];
+    return v;
+}
+
+template <class Tree>
+double time_lookups(Tree& tree, const std::vector<int>& lookups, size_t& hits){
+    return time_per_op(lookups.size(), [&]{
+        for(int k : lookups)
+            hits += tree.find(k) != tree.end();
+    });
+}
+
+void bench_splay(size_t n){
+    std::vector<int> keys(n);
+    for(size_t i = 0; i < n; i++)
+        keys[i] = 2*i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+    Bst<int, int, std::less<int>, avl_balanced> avl;
+    Bst<int, int, std::less<int>, splay_balanced> splay;
+    for(int k : keys){
+        avl.insert({k,k});
+        splay.insert({k,k});
+    }
+    std::vector<int> uniform(n);
+    std::mt19937 rng(2);
+    for(auto& k : uniform)
+        k = 2*(rng() % n);
+    size_t hits = 0;
+    std::cout << "find among " << n << " keys (avl height " << avl.height() << ")" << std::endl;
+    for(double s : {1.2, 1.0, 0.8}){
+        std::vector<int> zipf = zipf_keys(n, n, s, 3);
+        time_lookups(splay, zipf, hits);						//the splay tree adapts to the distribution first
+        double t_avl = time_lookups(avl, zipf, hits);
+        double t_splay = time_lookups(splay, zipf, hits);
+        std::cout << "  zipf s=" << s << ": avl " << t_avl << " ns, splay " << t_splay << " ns" << std::endl;
+    }
+    double t_avl = time_lookups(avl, uniform, hits);
+    double t_splay = time_lookups(splay, uniform, hits);
+    std::cout << "  uniform: avl " << t_avl << " ns, splay " << t_splay << " ns (" << hits << " hits)" << std::endl;
+}
+
+/*
+****** 13. SAVE AND LOAD: insert loop vs load ******
+*The file is read from the page cache: the first load only warms it up.
+*Load throughput is bounded by the allocation of the nodes, see the pool allocator.
+*/
+template <class Tree, class Key>
+void bench_save_load_tree(const char* name, const std::vector<std::pair<Key, int>>& pairs){
+    size_t n = pairs.size();
+    const char* path = "bench_tree.bst";
+    Tree tree1, tree2;
+    double t_insert = time_per_op(n, [&]{
+        for(const auto& x : pairs)
+            tree1.insert(x);
+    });
+    double t_save = time_per_op(n, [&]{ tree1.save(path); });
+    tree2.load(path);
+    tree2.clear();
+    double t_load = time_per_op(n, [&]{ tree2.load(path); });
+    std::FILE* f = std::fopen(path, "rb");
+    std::fseek(f, 0, SEEK_END);
+    double mb = std::ftell(f) / 1e6;
+    std::fclose(f);
+    std::remove(path);
+    std::cout << "  " << name << ": insert " << t_insert << " ns, save " << t_save << " ns, load " << t_load 
+              << " ns (" << mb / (t_load * n * 1e-9) << " MB/s of " << mb << " MB)" << std::endl;
+}
+
+void bench_save_load(size_t n){
+    std::vector<std::pair<int, int>> ints;
+    std::vector<std::pair<std::string, int>> strings;
+    for(int k : random_keys(n, 1)){
+        ints.push_back({k,k});
+        strings.push_back({"key:" + std::to_string(k) + std::string(k % 24, '.'), k});
+    }
+    std::cout << "save and load " << n << " pairs" << std::endl;
+    bench_save_load_tree<Bst<int, int, std::less<int>, avl_balanced>>("int keys", ints);
+    bench_save_load_tree<Bst<int, int, std::less<int>, avl_balanced, pool_allocator<std::pair<const int, int>>>>("int keys, pool", ints);
+    bench_save_load_tree<Bst<std::string, int, std::less<std::string>, avl_balanced>>("string keys", strings);
+}
+
+/*
+****** 14. REOPEN: load of a saved Bst vs mapping a MappedBst ******
+*Time until the first lookup is answered, then the lookups on each tree (the files are in the page cache).
+*/
+void bench_mapped(size_t n){
+    std::vector<int> keys = random_keys(n, 1);
+    const char* saved = "bench_tree.bst";
+    const char* path = "bench_tree.map";
+    std::remove(path);
+    {
+        Bst<int, int, std::less<int>, avl_balanced> tree;
+        MappedBst<int, int> mapped{path};
+        double t_insert = time_per_op(n, [&]{
+            for(int k : keys)
+                mapped.insert({k,k});
+        });
+        double t_sync = time_per_op(1, [&]{ mapped.sync(); });
+        for(int k : keys)
+            tree.insert({k,k});
+        tree.save(saved);
+        std::cout << "mapped tree of " << n << " keys: insert " << t_insert << " ns, sync " << t_sync / 1e6 << " ms" << std::endl;
+    }
+    std::vector<int> lookups = random_keys(n, 2);
+    size_t hits = 0;
+    Bst<int, int, std::less<int>, avl_balanced> tree;
+    double t_load = time_per_op(1, [&]{
+        tree.load(saved);
+        hits += tree.find(lookups[0]) != tree.end();
+    });
+    double t_find = time_lookups(tree, lookups, hits);
+    MappedBst<int, int>* mapped = nullptr;
+    double t_open = time_per_op(1, [&]{
+        mapped = new MappedBst<int, int>{path};
+        hits += mapped->find(lookups[0]) != mapped->end();
+    });
+    double t_find_mapped = time_lookups(*mapped, lookups, hits);
+    delete mapped;
+    std::remove(saved);
+    std::remove(path);
+    std::cout << "  ready after: load " << t_load / 1e6 << " ms, map " << t_open / 1e6 << " ms" << std::endl;
+    std::cout << "  find: Bst " << t_find << " ns, mapped " << t_find_mapped << " ns (" << hits << " hits)" << std::endl;
+}
+
+/*
+****** 15. WRITE AHEAD LOG: insert into a Bst vs a LoggedBst under each fsync policy ******
+*The logged inserts only queue the change; the flush waits for the writer thread to catch up.
+*/
+void bench_wal(size_t n){
+    std::vector<int> keys = random_keys(n, 1);
+    const char* snapshot = "bench_tree.bst";
+    const char* log = "bench_tree.log";
+    Bst<int, int, std::less<int>, avl_balanced> plain;
+    double t_plain = time_per_op(n, [&]{
+        for(int k : keys)
+            plain.insert({k,k});
+    });
+    std::cout << "logged inserts of " << n << " keys (plain insert " << t_plain << " ns)" << std::endl;
+    const std::pair<fsync_policy, const char*> policies[] = {{fsync_policy::always, "always"}, 
+        {fsync_policy::interval, "interval 10ms"}, {fsync_policy::never, "never"}};
+    for(const auto& p : policies){
+        std::remove(snapshot);
+        std::remove(log);
+        double t_insert, t_flush;
+        {
+            LoggedBst<int, int> tree{snapshot, log, p.first, std::chrono::milliseconds(10)};
+            t_insert = time_per_op(n, [&]{
+                for(int k : keys)
+                    tree.insert({k,k});
+            });
+            t_flush = time_per_op(1, [&]{ tree.flush(); });
+        }
+        LoggedBst<int, int> tree{snapshot, log};
+        const replay_stats& r = tree.recovered();
+        std::cout << "  fsync " << p.second << ": insert " << t_insert << " ns, flush " << t_flush / 1e6 << " ms, replay "
+                  << r.records / r.seconds / 1e6 << " M changes/s (" << r.bytes / r.seconds / 1e6 << " MB/s)" << std::endl;
+    }
+    std::remove(snapshot);
+    std::remove(log);
+}
+
+/*
+****** 16. STATS: the shape of the tree in one walk, and the counters with make bench STATS=1 ******
+*/
+void bench_stats(size_t n){
+    std::vector<int> keys = random_keys(n, 1);
+    std::vector<int> lookups = random_keys(n, 2);
+    Bst<int, int, std::less<int>, avl_balanced> tree;
+    for(int k : keys)
+        tree.insert({k,k});
+    size_t hits = 0;
+    time_lookups(tree, lookups, hits);
+    tree_stats s;
+    size_t h = 0;
+    double t_stats = time_per_op(n, [&]{ s = tree.stats(); });
+    double t_height = time_per_op(n, [&]{ h = tree.height(); });
+    double depth_sum = 0;
+    for(size_t d = 0; d < s.depths.size(); d++)
+        depth_sum += double(d) * s.depths[d];
+    std::cout << "stats of " << s.size << " keys: " << t_stats << " ns per node (height() " << t_height 
+              << " ns), height " << s.height << " = " << h << ", average depth " << depth_sum / s.size << std::endl;
+    if(bst_stats)
+        std::cout << "  comparisons per find " << double(s.ops.find_comparisons) / s.ops.finds << ", per insert "
+                  << double(s.ops.insert_comparisons) / s.ops.inserts << ", nodes allocated " << s.ops.nodes_allocated << std::endl;
+}
+
+/*
+****** 17. BALANCE CHECK: check_balance and height without and with cached_height ******
+*check_balance walks every node once; with cached_height it reads the count of the nodes out of balance
+*and height() the height kept in the root, both O(1).
+*/
+template <class Tree>
+void bench_check_balance_tree(const char* name, const std::vector<int>& keys){
+    size_t n = keys.size();
+    Tree tree;
+    double t_insert = time_per_op(n, [&]{
+        for(int k : keys)
+            tree.insert({k,k});
+    });
+    tree.balance();
+    bool ok = true;
+    size_t h = 0;
+    double t_check = time_per_op(n, [&]{ ok = tree.check_balance(); });
+    double t_height = time_per_op(1, [&]{ h = tree.height(); });
+    Tree vine;												//sorted keys: a vine to the right (quadratic to build,
+    size_t n_vine = std::min(n, size_t(1) << 14);			// so a small one)
+    for(size_t i = 0; i < n_vine; i++)
+        vine.insert({int(i), int(i)});
+    bool vine_ok = true;
+    double t_vine = time_per_op(1, [&]{ vine_ok = vine.check_balance(); });
+    std::cout << "  " << name << ": insert " << t_insert << ", check_balance " << t_check << " ns per node (" << ok 
+              << "), height() " << t_height << " ns (" << h << "), check_balance of a vine of " << n_vine << " keys " 
+              << t_vine / 1000 << " us (" << vine_ok << ")" << std::endl;
+}
+void bench_check_balance(size_t n){
+    std::vector<int> keys = random_keys(n, 1);
+    std::cout << "check_balance of " << n << " keys" << std::endl;
+    bench_check_balance_tree<Bst<int, int>>("unbalanced", keys);
+    bench_check_balance_tree<Bst<int, int, std::less<int>, cached_height<>>>("cached_height", keys);
+}
+
+/*
+****** 18. CLEAR OF A POOL TREE: blocks freed at once vs nodes freed one by one ******
+*The pool frees its blocks at once when the tree holds every object living in it, even when it is shared
+*(moved-from tree, copy of the allocator); a second tree with nodes in the pool forces the slow way.
+*/
+void bench_pool_clear(size_t n){
+    using pool_tree = Bst<int, int, std::less<int>, avl_balanced, pool_allocator<std::pair<const int, int>>>;
+    std::vector<int> keys = random_keys(n, 1);
+    auto fill = [&](pool_tree& t){
+        for(int k : keys)
+            t.insert({k,k});
+    };
+    std::cout << "clear of " << n << " keys (ns per node)" << std::endl;
+    {
+        pool_tree tree;
+        fill(tree);
+        std::cout << "  own pool " << time_per_op(tree.size(), [&]{ tree.clear(); });
+    }
+    {
+        pool_tree from;
+        pool_tree tree{std::move(from)};
+        fill(tree);
+        auto copy = tree.get_allocator();
+        std::cout << ", after a move and with a copy of the allocator " << time_per_op(tree.size(), [&]{ tree.clear(); });
+    }
+    {
+        pool_tree tree;
+        fill(tree);
+        pool_tree other{tree.get_allocator()};
+        other.insert({-1,-1});
+        std::cout << ", sharing the pool with another tree " << time_per_op(tree.size(), [&]{ tree.clear(); }) << std::endl;
+    }
+}
+
+int main(){
+    std::cout << "Benchmarks (ns per operation)" << std::endl;
+    for(size_t n : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_frozen(n);
+    for(size_t n : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_wide(n);
+    bench_batch(size_t(1) << 20, 10000);
+    bench_batch(size_t(1) << 20, 100000);
+    bench_batch(size_t(1) << 20, 1000000);
+    for(size_t n : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_find_many(n);
+    for(size_t n : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_scan(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_parallel(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_build(n);
+    bench_union(size_t(1) << 20, 1000);
+    bench_union(size_t(1) << 20, 100000);
+    bench_union(size_t(1) << 20, size_t(1) << 20);
+    for(size_t n : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20})
+        bench_transparent(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20})
+        bench_duplicates(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20})
+        bench_hint(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20})
+        bench_splay(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_save_load(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+        bench_mapped(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20})
+        bench_wal(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20})
+        bench_stats(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20})
+        bench_check_balance(n);
+    for(size_t n : {size_t(1) << 16, size_t(1) << 20})
+        bench_pool_clear(n);
+    return 0;
+}
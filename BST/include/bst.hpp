@@ -7,8 +7,18 @@
 #include <algorithm>
 #include <vector>
 #include <cmath>
+#include <type_traits>
+#include <iterator>
+#include <atomic>
+#include <stdexcept>
+#include <tuple>
+#include <new>
+#include <chrono>
+#include <cstdint>
 
 #include "iterator.hpp"
+#include "thread_pool.hpp"
+#include "serializer.hpp"
 /*
 *************** Class BINARY SEARCH TREE ****************
 *The binary search tree is implemented here where each node of the tree
@@ -25,168 +35,1028 @@
 *2. EMPLACE --> Insert value with the given args
 *3. BALANCE --> Balance the tree
 *4. ERASE  --> Erase a key from the tree
+*
+*The last template parameter selects the balancing policy of the tree.
+*By default the tree is never rebalanced by insert/erase (use balance()).
 */
-template <typename key_type, typename value_type, typename comp_op = std::less<key_type>>
+
+/*
+*************** Balancing policies ****************
+*unbalanced   --> insert and erase never restructure the tree (default)
+*avl_balanced --> every insert, emplace, operator[] and erase retraces the path 
+*                 to the root and rotates, keeping the height of the tree O(log n)
+*splay_balanced --> insert moves the new node up toward the root by rotations (semi-splaying), erase
+*                 the parent of the node erased, and one find/operator[] in 8 the node found: the keys
+*                 used often stay near the root. The const find doesn't restructure the tree.
+*order_statistics<P> --> balances as P, and every node also stores the size of its subtree,
+*                 which gives rank, select and count_range in O(height)
+*                 ==> Bst<int, int, std::less<int>, order_statistics<avl_balanced>> tree;
+*threaded<P>  --> balances as P, and the nodes are also linked in order (next/prev),
+*                 so that every step of the iterators is O(1) in the worst case
+*cached_height<P> --> balances as P, and every insert and erase also keeps the height stored in the
+*                 nodes up to date (avl_balanced and splay_balanced always do), so height() is O(1);
+*                 cached_height<unbalanced> also counts its nodes out of balance for check_balance()
+*The wrappers can be combined ==> threaded<order_statistics<avl_balanced>>
+*/
+struct unbalanced {};
+struct avl_balanced {};
+struct splay_balanced {};
+struct order_statistics_tag {};
+struct threaded_tag {};
+struct cached_height_tag {};
+template <class P = unbalanced>
+	struct order_statistics : P, order_statistics_tag {};
+template <class P = unbalanced>
+	struct threaded : P, threaded_tag {};
+template <class P = unbalanced>
+	struct cached_height : P, cached_height_tag {};
+
+template <class P>
+	struct is_order_statistics : std::is_base_of<order_statistics_tag, P> {};
+template <class P>
+	struct is_threaded : std::is_base_of<threaded_tag, P> {};
+//The policies under which every node always stores the height of its subtree
+template <class P>
+	struct keeps_heights : std::integral_constant<bool, std::is_base_of<avl_balanced, P>::value || 
+		std::is_base_of<splay_balanced, P>::value || std::is_base_of<cached_height_tag, P>::value> {};
+
+//Number of nodes in the subtree of a node, stored only with order_statistics
+template <bool enabled>
+	struct subtree_size {
+		static constexpr size_t get() noexcept { return 0; }
+		void set(size_t) noexcept {}
+	};
+template <>
+	struct subtree_size<true> {
+		size_t size = 1;
+		size_t get() const noexcept { return size; }
+		void set(size_t n) noexcept { size = n; }
+	};
+
+//In-order links of a node of type N, stored only with threaded
+template <class N, bool enabled>
+	struct inorder_links {
+		static constexpr bool linked = false;
+		void link_after(N*) noexcept {}
+		void link_before(N*) noexcept {}
+		void append_to(N*) noexcept {}
+		void set_links(N*, N*) noexcept {}
+		void splice(N*) noexcept {}
+		void cut_after() noexcept {}
+		void unlink() noexcept {}
+	};
+template <class N>
+	struct inorder_links<N, true> {
+		static constexpr bool linked = true;
+		N* prev = nullptr;
+		N* next = nullptr;
+
+		N* self() noexcept { return static_cast<N*>(this); }
+		//Put the node right after p / right before n in the order
+		void link_after(N* p) noexcept{
+			prev = p;
+			next = p->next;
+			p->next = self();
+			if(next) next->prev = self();
+		}
+		void link_before(N* n) noexcept{
+			next = n;
+			prev = n->prev;
+			n->prev = self();
+			if(prev) prev->next = self();
+		}
+		//Put the node after tail, as the last node of a list being built
+		void append_to(N* tail) noexcept{
+			prev = tail;
+			next = nullptr;
+			if(tail) tail->next = self();
+		}
+		//Set the neighbours of the node, leaving theirs alone
+		void set_links(N* p, N* n) noexcept{
+			prev = p;
+			next = n;
+		}
+		//Link the node, the last of a list, to n, the first of another one
+		void splice(N* n) noexcept{
+			next = n;
+			n->prev = self();
+		}
+		//End the list after the node
+		void cut_after() noexcept{
+			if(next) next->prev = nullptr;
+			next = nullptr;
+		}
+		void unlink() noexcept{
+			if(prev) prev->next = next;
+			if(next) next->prev = prev;
+			prev = next = nullptr;
+		}
+	};
+
+/*
+*************** Statistics ****************
+*tree.stats() gives the size, the height and the number of nodes at each depth in one O(n) walk.
+*Compiled with -DBST_STATS the trees also count their operations, given in stats().ops:
+*the finds, inserts and erases with the comparisons they made, the nodes allocated and freed
+*(not the ones handed over by extract), the calls to balance() and the time spent in it.
+*Without BST_STATS the counters are not there and cost nothing.
+*/
+#ifdef BST_STATS
+constexpr bool bst_stats = true;
+#else
+constexpr bool bst_stats = false;
+#endif
+
+//The operations counted by a tree
+struct op_counts{
+	std::uint64_t finds = 0;
+	std::uint64_t find_comparisons = 0;
+	std::uint64_t inserts = 0;
+	std::uint64_t insert_comparisons = 0;
+	std::uint64_t erases = 0;
+	std::uint64_t erase_comparisons = 0;
+	std::uint64_t nodes_allocated = 0;
+	std::uint64_t nodes_freed = 0;
+	std::uint64_t balances = 0;
+	std::uint64_t balance_ns = 0;
+};
+
+//The shape of a tree and its counters ==> auto s = tree.stats();
+struct tree_stats{
+	size_t size = 0;
+	size_t height = 0;
+	std::vector<size_t> depths;		//depths[d] is the number of nodes at depth d, the root is at depth 0
+	op_counts ops;					//all zero without BST_STATS
+};
+
+enum class op_kind { find, insert, erase, balance };
+
+//The counters of a tree, kept only with BST_STATS
+template <bool enabled>
+	struct op_counters {
+		void count(op_kind, std::uint64_t, std::uint64_t) const noexcept {}
+		void allocated() const noexcept {}
+		void freed(size_t) const noexcept {}
+		op_counts get() const noexcept { return op_counts(); }
+		void reset() noexcept {}
+	};
+template <>
+	struct op_counters<true> {
+		mutable std::atomic<std::uint64_t> ops[4];				//by op_kind
+		mutable std::atomic<std::uint64_t> comparisons[4];
+		mutable std::atomic<std::uint64_t> nodes_allocated;
+		mutable std::atomic<std::uint64_t> nodes_freed;
+		mutable std::atomic<std::uint64_t> balance_ns;
+
+		op_counters() noexcept { reset(); }
+
+		//Comparisons made by this thread, and whether it is inside a counted operation
+		static std::uint64_t& comparisons_here() noexcept { static thread_local std::uint64_t n = 0; return n; }
+		static bool& in_op() noexcept { static thread_local bool b = false; return b; }
+
+		void count(op_kind k, std::uint64_t cmp, std::uint64_t ns) const noexcept{
+			ops[int(k)].fetch_add(1, std::memory_order_relaxed);
+			comparisons[int(k)].fetch_add(cmp, std::memory_order_relaxed);
+			if(k == op_kind::balance)
+				balance_ns.fetch_add(ns, std::memory_order_relaxed);
+		}
+		void allocated() const noexcept { nodes_allocated.fetch_add(1, std::memory_order_relaxed); }
+		void freed(size_t n) const noexcept { nodes_freed.fetch_add(n, std::memory_order_relaxed); }
+		op_counts get() const noexcept{
+			op_counts c;
+			c.finds = ops[int(op_kind::find)];
+			c.find_comparisons = comparisons[int(op_kind::find)];
+			c.inserts = ops[int(op_kind::insert)];
+			c.insert_comparisons = comparisons[int(op_kind::insert)];
+			c.erases = ops[int(op_kind::erase)];
+			c.erase_comparisons = comparisons[int(op_kind::erase)];
+			c.nodes_allocated = nodes_allocated;
+			c.nodes_freed = nodes_freed;
+			c.balances = ops[int(op_kind::balance)];
+			c.balance_ns = balance_ns;
+			return c;
+		}
+		void reset() noexcept{
+			for(int k = 0; k < 4; k++){
+				ops[k] = 0;
+				comparisons[k] = 0;
+			}
+			nodes_allocated = 0;
+			nodes_freed = 0;
+			balance_ns = 0;
+		}
+	};
+
+//Counts an operation of a tree and the comparisons made until the end of the scope.
+//Only the outermost scope counts: an erase is not also a find.
+template <bool enabled>
+	struct op_scope {
+		op_scope(const op_counters<enabled>&, op_kind) noexcept {}
+	};
+template <>
+	struct op_scope<true> {
+		using clock = std::chrono::steady_clock;
+		const op_counters<true>& counters;
+		op_kind kind;
+		bool outer;
+		std::uint64_t start;
+		clock::time_point start_time;
+
+		op_scope(const op_counters<true>& c, op_kind k) noexcept: counters(c), kind{k}, outer{!op_counters<true>::in_op()},
+			start{op_counters<true>::comparisons_here()}, start_time{k == op_kind::balance ? clock::now() : clock::time_point()} {
+			op_counters<true>::in_op() = true;
+		}
+		~op_scope(){
+			if(!outer)
+				return;
+			op_counters<true>::in_op() = false;
+			std::uint64_t ns = kind == op_kind::balance ? std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_time).count() : 0;
+			counters.count(kind, op_counters<true>::comparisons_here() - start, ns);
+		}
+		op_scope(const op_scope&) = delete;
+		op_scope& operator=(const op_scope&) = delete;
+	};
+
+//The comparator of a tree with BST_STATS: it counts its calls in the thread making them
+template <class C>
+	struct counting_compare {
+		C comp;
+
+		counting_compare(const C& c): comp(c) {}
+		operator const C&() const noexcept { return comp; }
+		template <class A, class B>
+		bool operator()(const A& a, const B& b) const{
+			++op_counters<true>::comparisons_here();
+			return comp(a, b);
+		}
+	};
+
+template <typename key_type, typename value_type, typename comp_op = std::less<key_type>, typename balance_policy = unbalanced,
+			typename alloc_type = std::allocator<std::pair<const key_type, value_type>>>
 	class Bst{
         //Tempalted struct node
+		static constexpr bool counted = is_order_statistics<balance_policy>::value;
+		static constexpr bool linked = is_threaded<balance_policy>::value;
+		static constexpr bool heights_kept = keeps_heights<balance_policy>::value;
+		static constexpr bool balance_counted = std::is_base_of<cached_height_tag, balance_policy>::value && 
+			!std::is_base_of<avl_balanced, balance_policy>::value && !std::is_base_of<splay_balanced, balance_policy>::value;
+
+		struct construct_tag {};
 		template <typename T>
-			struct node{
+			struct node: subtree_size<counted>, inorder_links<node<T>, linked>{
 				T value;
 				node* parent;	
-				std::unique_ptr<node> left;		//unique pointer to the left child
-				std::unique_ptr<node> right;	//unique pointer to the right child
+				node* left;						//pointer to the left child (the nodes are owned by the tree)
+				node* right;					//pointer to the right child
+				int height;						//height of the subtree rooted here (kept up to date when heights_kept)
+				bool out_of_balance = false;	//its subtrees differ in height by more than 1 (kept when balance_counted)
 							
 				public:
-					node(const T& v): value{v}, parent{nullptr} {}
-					node(T &&v): value{std::move(v)}, parent{nullptr} {}
-
-					node(const T& v, node* p): value{v}, parent{p} {}
-					node(T &&v, node* p): value{std::move(v)}, parent{p} {}
-
-					explicit node(const std::unique_ptr<node> &x, node* p): value{x->value} {
-						this->parent = p;
-						if(x->left)
-							left = std::make_unique<node>(x->left,this);
-						if(x->right)
-							right = std::make_unique<node>(x->right,this);
-					}
+					node(const T& v): value{v}, parent{nullptr}, left{nullptr}, right{nullptr}, height{1} {}
+					node(T &&v): value{std::move(v)}, parent{nullptr}, left{nullptr}, right{nullptr}, height{1} {}
+
+					node(const T& v, node* p): value{v}, parent{p}, left{nullptr}, right{nullptr}, height{1} {}
+					node(T &&v, node* p): value{std::move(v)}, parent{p}, left{nullptr}, right{nullptr}, height{1} {}
+					//The value built in place from args
+					template <class... Args>
+					node(construct_tag, Args&&... args): value(std::forward<Args>(args)...), parent{nullptr}, left{nullptr}, right{nullptr}, height{1} {}
 			};
-            comp_op compare;
+            //comp_op itself, which counts its calls with BST_STATS
+            typename std::conditional<bst_stats, counting_compare<comp_op>, comp_op>::type compare;
+            mutable op_counters<bst_stats> counters;
 
 			using pair_type = std::pair<const key_type, value_type>;
 			using node_type = node<pair_type>;
+			//The nodes are allocated with alloc_type rebound to node_type
+			using node_alloc = typename std::allocator_traits<alloc_type>::template rebind_alloc<node_type>;
+			using node_traits = std::allocator_traits<node_alloc>;
 
-			std::unique_ptr<node_type> root;
+			node_alloc alloc;
+			node_type* root;
+			size_t n_nodes;				//number of nodes in the tree
+			size_t n_out_of_balance = 0;	//number of nodes marked out_of_balance
+
+            //Allocate and construct a node with the given arguments
+            template <class... Types>
+            node_type* create_node(Types&&... args){
+                node_type* x = node_traits::allocate(alloc, 1);
+                try{
+                    node_traits::construct(alloc, x, std::forward<Types>(args)...);
+                }catch(...){
+                    node_traits::deallocate(alloc, x, 1);
+                    throw;
+                }
+                counters.allocated();
+                return x;
+            }
+            //Destroy and deallocate a single node (its children are left untouched)
+            void destroy_node(node_type* x) noexcept{
+                node_traits::destroy(alloc, x);
+                node_traits::deallocate(alloc, x, 1);
+                counters.freed(1);
+            }
+            //Destroy every node of the subtree rooted at x
+            void destroy_subtree(node_type* x) noexcept;
+            //Copy the subtree rooted at x, the copy is attached to the parent p
+            node_type* clone(node_type* x, node_type* p);
+            //Free the n nodes of the tree at once if the allocator is a pool allowing it
+            template <class A>
+            static auto release_pool(A& a, size_t n, int) noexcept -> decltype(a.release_all(n)) { return a.release_all(n); }
+            template <class A>
+            static bool release_pool(A&, size_t, long) noexcept { return false; }
 
             //some auxillary private functions 
             //To find the height of the tree/subtree starting with any node x
 			size_t height(node_type* x) noexcept;
 
-			//To check if the tree/subtree is balanced or not
-			bool isBalanced(node_type* x) noexcept;
+			//To check if the tree/subtree is balanced or not, in a single post-order pass
+			bool isBalanced(node_type* x) const;
+            //No balanced tree of n nodes is h high: it needs at least N(h) = N(h-1) + N(h-2) + 1 nodes
+            static bool too_tall(size_t n, size_t h) noexcept{
+                size_t a = 0, b = 1;					//N(0), N(1)
+                for(size_t i = 0; i < h && a <= n; i++){
+                    size_t c = a + b + 1;
+                    a = b;
+                    b = c;
+                }
+                return a > n;
+            }
             //To balance the tree
-			void balance_aux(std::vector<pair_type> v_balance, size_t size);
+            //Turn the tree into a vine (a list linked through the right children) by right rotations.
+            //Returns the number of nodes; head is the smallest node.
+			size_t tree_to_vine(node_type*& head) noexcept;
+            //Relink the first n nodes of the vine into a perfectly balanced subtree and return its root
+			node_type* vine_to_tree(node_type*& head, size_t n) noexcept;
+            //Link the nodes of a vine / of the whole tree in order (with threaded, nothing to do otherwise)
+            void thread_vine(node_type* head) noexcept{
+                node_type* tail = nullptr;
+                for(node_type* x = head; linked && x; x = x->right){
+                    x->append_to(tail);
+                    tail = x;
+                }
+            }
+            void thread_tree() noexcept{
+                node_type* tail = nullptr;
+                node_type* x = root;
+                while(linked && x && x->left)
+                    x = x->left;
+                for(; linked && x; x = iterator::successor(x)){
+                    x->append_to(tail);
+                    tail = x;
+                }
+            }
+            //Sort the n nodes of a vine by key keeping only the first node of each key, returns the nodes left
+			size_t sort_vine(node_type*& head, size_t n);
+            //Replace the tree with the nodes given by next() until it returns nullptr, see assign_sorted
+            template <class Next>
+            void assign_vine(Next next, bool checked);
+            //Call f(node) on the nodes of the subtree x in order, without recursion
+            template <class F>
+            static void for_each_node(node_type* x, F f);
+            //The trees smaller than this are traversed by a single task
+            static constexpr size_t parallel_grain = 1 << 14;
+            //The subtrees at this depth are the tasks of the parallel traversals
+            static constexpr int parallel_depth = 8;
+            //Cut the tree into pieces, numbered in order: the subtrees at parallel_depth (whole) 
+            //and the nodes above them (alone). prepare(number of pieces) is called first, then 
+            //f(i, node) on every node of the piece i; the subtrees are traversed by the tasks of the pool.
+            template <class Prepare, class F>
+            void parallel_aux(thread_pool& pool, Prepare prepare, F f) const;
+            //The nodes can be allocated by several threads at once only with std::allocator
+            static constexpr bool concurrent_alloc = std::is_same<node_alloc, std::allocator<node_type>>::value;
+            //Link the sorted nodes[lo, hi) into a balanced subtree and return its root, the middle node.
+            //The subtrees cut levels below are not entered: with spawn they are linked by tasks of the
+            //group, without it they are taken as already linked (a negative cut links everything).
+            node_type* link_range(node_type* const* nodes, size_t lo, size_t hi, int cut, task_group* spawn);
+            //Join based operations on detached subtrees (their roots have no parent):
+            //k with the left subtree l and the right subtree r, its height and size recomputed
+            static node_type* attach(node_type* l, node_type* k, node_type* r) noexcept;
+            //Rotations of a detached subtree, returning the new root
+            static node_type* detached_left(node_type* x) noexcept;
+            static node_type* detached_right(node_type* x) noexcept;
+            //The AVL tree of the keys of l, then k, then the keys of r (k is a single node)
+            static node_type* join3(node_type* l, node_type* k, node_type* r) noexcept;
+            static node_type* join_right(node_type* l, node_type* k, node_type* r) noexcept;
+            static node_type* join_left(node_type* l, node_type* k, node_type* r) noexcept;
+            //The AVL tree of the keys of l, then of r
+            static node_type* join2(node_type* l, node_type* r) noexcept;
+            //Detach the last node of t (returned in last) and return the tree of the other nodes
+            static node_type* split_last(node_type* t, node_type*& last) noexcept;
+            //Split t into the keys less than x (l), the node of x (m, nullptr if none) and the keys greater (r)
+            void split3(node_type* t, const key_type& x, node_type*& l, node_type*& m, node_type*& r);
+            //Number of nodes of a, knowing that a and b have n nodes: the two are walked in lockstep
+            //until one of them is over, so the cost is the size of the smaller
+            static size_t size_of_first(node_type* a, node_type* b, size_t n) noexcept;
+            enum set_kind { set_union, set_intersection, set_difference };
+            //a op b; found counts the keys of b also in a
+            node_type* set_aux(node_type* a, node_type* b, set_kind kind, thread_pool* pool, int depth, std::atomic<size_t>& found);
+            void set_operation(Bst& other, set_kind kind, thread_pool* pool);
+            //The root of the nodes of other in our allocator: taken over if the allocators are equal, copied otherwise
+            node_type* take_nodes(Bst& other, bool& copied);
+            //Private constructor of a tree owning the nodes of the subtree x
+            struct adopt_tag {};
+            Bst(adopt_tag, const comp_op& comp, const node_alloc& a, node_type* x, size_t n): compare{comp}, alloc{a}, root{x}, n_nodes{n} {}
+            //The lookups take a key_type, or any key K the comparator compares with it if it is transparent.
+            //Node of the key x, nullptr if it is not in the tree
+            template <class K>
+            node_type* find_node(const K& x) const;
+            //Node of the first key not less than x / greater than x, nullptr if there is none
+            template <class K>
+            node_type* lower_node(const K& x) const;
+            template <class K>
+            node_type* upper_node(const K& x) const;
+            //Number of keys less than x
+            template <class K>
+            size_t rank_aux(const K& x) const;
+            template <class K>
+            void erase_aux(const K& x);
+            //for_each_in_range on a tree or a const tree
+            template <class Tree, class K, class L, class Fn>
+            static void range_aux(Tree& tree, const K& lo, const L& hi, Fn& fn){
+                for(auto it = tree.lower_bound(lo); it != tree.end() && tree.compare((*it).first, hi); ++it)
+                    fn(*it);
+            }
+            //Node of the k-th smallest key, nullptr if k >= size()
+            node_type* select_node(size_t k) const noexcept;
+            //Number of lookups kept in flight by find_many
+            static constexpr int find_group = 16;
+            //Look up the keys in [first, last) interleaving the walks, found(i, node) is called for the i-th key
+            template <class RandomIt, class Found>
+            void find_many_aux(RandomIt first, RandomIt last, Found found) const;
+            //Apply a batch of pairs, see insert_batch/upsert_batch
+            template <class Range, class Merge>
+            std::vector<bool> batch_aux(const Range& batch, Merge merge_fn, bool upsert);
             //To tell what child is the node x; 1 if x is a right child, 0 if x is a right child, -1 if x doesnt have a parent (i.e. x is root)
             int childhoodSide(node_type* x) noexcept{
                 if(x->parent){
-				if(x->parent->left.get() == x) return 0;
-				if(x->parent->right.get() == x) return 1;
+				if(x->parent->left == x) return 0;
+				if(x->parent->right == x) return 1;
                 }
                 return -1;
 			}
             //To release a child of node x from the provided child side chSide 
             void release_child(node_type* x, int chSide) noexcept{
-				 if(chSide == 1) x->right.release();
-				 if(chSide == 0) x->left.release();
+				 if(chSide == 1) x->right = nullptr;
+				 if(chSide == 0) x->left = nullptr;
 			}
             //To reset a child of given side of node x with the node y  
 			void reset_child(node_type* x, node_type* y, int chSide) noexcept {
-				if(chSide == 1) x->right.reset(y);
-				if(chSide == 0) x->left.reset(y);
+				if(chSide == 1) x->right = y;
+				if(chSide == 0) x->left = y;
 			}
             //To swap two nodes -- the children and the parent are swapped
+            //y heads the subtree of x: so far its stored height and size are those of x
             void swap_node(node_type* x, node_type* y);
+            //The fields the policies keep in a node, copied from src
+            static void copy_kept(node_type* dst, const node_type* src) noexcept{
+                dst->height = src->height;
+                dst->set(src->get());
+                dst->out_of_balance = src->out_of_balance;
+            }
+            //Take the node a out of the tree, rebalancing it (a is neither freed nor reset)
+            void detach_node(node_type* a) noexcept;
+            //The node of the key x, or nullptr and the place of x: below parent on the side (0 left, 1 right,
+            //parent nullptr in an empty tree)
+            template <class K>
+            node_type* find_slot(const K& x, node_type*& parent, int& side) const;
+            //find_slot starting from the node hint (nullptr for end()) when x goes right before or right after it
+            template <class K>
+            node_type* find_slot_near(node_type* hint, const K& x, node_type*& parent, int& side) const;
+            //Link the lone node x in the place found by find_slot and rebalance, returns x
+            node_type* link_node(node_type* x, node_type* parent, int side) noexcept;
             //The right and left children of node x are released and the node is deleted 
-            void delete_node(node_type* x){
-                if(x->right) x->right.release();
-                if(x->left) x->left.release();
-                delete x;
+            void delete_node(node_type* x) noexcept{
+                x->right = nullptr;
+                x->left = nullptr;
+                destroy_node(x);
+            }
+
+            //Height stored in the node x (0 for an empty subtree) 
+            static int node_height(node_type* x) noexcept { return x ? x->height : 0; }
+            //Size stored in the node x (0 for an empty subtree, or when the sizes are not kept)
+            static size_t node_size(node_type* x) noexcept { return x ? x->get() : 0; }
+            //Recompute the stored height (and size) of x from the ones of its children
+            static void pull(node_type* x) noexcept { 
+                x->height = 1 + std::max(node_height(x->left), node_height(x->right)); 
+                if(counted)
+                    x->set(1 + node_size(x->left) + node_size(x->right));
+            }
+            //Rotate the subtree rooted at x to the left/right; in-order and iterators are preserved
+            void rotate_left(node_type* x) noexcept;
+            void rotate_right(node_type* x) noexcept;
+            //Restore the invariant of the balancing policy walking up from x after x's subtree changed
+            void rebalance(node_type* x) noexcept { rebalance(x, balance_policy{}); }
+            //Only the sizes to fix up to the root, and with cached_height the heights and marks until a height
+            //is unchanged (above it no node sees a change in its subtrees)
+            void rebalance(node_type* x, unbalanced) noexcept {
+                for(; (counted || heights_kept) && x; x = x->parent){
+                    int old_height = x->height;
+                    pull(x);
+                    mark(x);
+                    if(!counted && x->height == old_height)
+                        return;
+                }
+            }
+            //With balance_counted, mark x if it is out of balance (the heights of its children are up to date)
+            void mark(node_type* x) noexcept{
+                if(!balance_counted)
+                    return;
+                bool now = std::abs(node_height(x->left) - node_height(x->right)) > 1;
+                if(now != x->out_of_balance){
+                    x->out_of_balance = now;
+                    now ? ++n_out_of_balance : --n_out_of_balance;
+                }
+            }
+            //x leaves the tree
+            void unmark(node_type* x) noexcept{
+                if(x->out_of_balance){
+                    x->out_of_balance = false;
+                    --n_out_of_balance;
+                }
+            }
+            void rebalance(node_type* x, avl_balanced) noexcept;
+            void rebalance(node_type* x, splay_balanced) noexcept{
+                pull(x);
+                splay(x);
+            }
+            //With splay_balanced, bring x up toward the root by rotations (semi-splaying)
+            static constexpr bool splayed = std::is_base_of<splay_balanced, balance_policy>::value;
+            void splay(node_type* x) noexcept;
+            //A lookup reached x: splay it with splay_balanced, returns x
+            //Only one lookup in splay_period splays: the hot keys still rise, at a fraction of the writes
+            static constexpr unsigned splay_period = 8;
+            unsigned n_accesses = 0;
+            node_type* accessed(node_type* x) noexcept{
+                if(splayed && x && ++n_accesses % splay_period == 0)
+                    splay(x);
+                return x;
             }
-            //To do a breadth first traversal in the tree
-			void bfs_aux(node_type* x, size_t level);
             
             public:
-                Bst(): compare{comp_op()}, root{nullptr} {}
-                Bst(comp_op comp): compare{comp}, root{nullptr} {}
-                Bst(key_type k, value_type v): compare{comp_op()}, root{std::make_unique<node_type>(std::pair<const key_type,value_type>(k,v))} {}
-                Bst(key_type k, value_type v, comp_op comp): compare{comp}, root{std::make_unique<node_type>(std::pair<const key_type,value_type>(k,v))} {}
+                Bst(): compare{comp_op()}, alloc{}, root{nullptr}, n_nodes{0} {}
+                Bst(comp_op comp, const alloc_type& a = alloc_type()): compare{comp}, alloc{a}, root{nullptr}, n_nodes{0} {}
+                explicit Bst(const alloc_type& a): compare{comp_op()}, alloc{a}, root{nullptr}, n_nodes{0} {}
+                Bst(key_type k, value_type v): compare{comp_op()}, alloc{}, root{nullptr}, n_nodes{1} { root = create_node(pair_type(k,v)); }
+                Bst(key_type k, value_type v, comp_op comp): compare{comp}, alloc{}, root{nullptr}, n_nodes{1} { root = create_node(pair_type(k,v)); }
+
+                ~Bst() noexcept { clear(); }
+
+                //Build the tree from a range of pairs sorted by key, see assign_sorted ==> Bst<k,v> tree{v.begin(), v.end()};
+                //Only for iterators over pairs: Bst<std::string, std::string> tree{"key", "value"} is a key and a value
+                template <class It, class = typename std::enable_if<std::is_convertible<typename std::iterator_traits<It>::reference, pair_type>::value,
+                                                                    typename std::iterator_traits<It>::iterator_category>::type>
+                Bst(It first, It last, comp_op comp = comp_op(), const alloc_type& a = alloc_type()): compare{comp}, alloc{a}, root{nullptr}, n_nodes{0} { 
+                    assign_sorted(first, last); 
+                }
 
                 //copy constructs
-                Bst(const Bst& tree): compare{tree.compare} { root = std::make_unique<node_type>(tree.root,nullptr); }
+                Bst(const Bst& tree): compare{tree.compare}, alloc{node_traits::select_on_container_copy_construction(tree.alloc)}, root{nullptr}, n_nodes{0} { 
+                    root = clone(tree.root, nullptr);
+                    thread_tree();
+                    n_nodes = tree.n_nodes;
+                    n_out_of_balance = tree.n_out_of_balance;
+                }
                 Bst& operator=(const Bst& tree){
                     if(&tree == this)
                         return *this;
                     this->clear();
                     compare = tree.compare;
-                    root = std::make_unique<node_type>(tree.root,nullptr);
+                    if(node_traits::propagate_on_container_copy_assignment::value)
+                        alloc = tree.alloc;
+                    root = clone(tree.root, nullptr);
+                    thread_tree();
+                    n_nodes = tree.n_nodes;
+                    n_out_of_balance = tree.n_out_of_balance;
                     return *this;
                 }
 
-                //move constructs
-                Bst(Bst&& tree) noexcept = default;
-                Bst& operator=(Bst &&tree) noexcept = default;
+                //move constructs. The iterators to the nodes stay valid, end() has to be taken from the new tree (see iterator.hpp)
+                Bst(Bst&& tree) noexcept: compare{std::move(tree.compare)}, alloc{std::move(tree.alloc)}, root{tree.root}, n_nodes{tree.n_nodes}, n_out_of_balance{tree.n_out_of_balance} { 
+                    tree.root = nullptr; 
+                    tree.n_nodes = 0;
+                    tree.n_out_of_balance = 0;
+                }
+                Bst& operator=(Bst &&tree){
+                    if(&tree == this)
+                        return *this;
+                    this->clear();
+                    compare = std::move(tree.compare);
+                    if(node_traits::propagate_on_container_move_assignment::value)
+                        alloc = tree.alloc;
+                    if(alloc == tree.alloc){				//the nodes can be taken over
+                        root = tree.root;
+                        tree.root = nullptr;
+                    }else{									//otherwise they have to be copied in our allocator (and the iterators are invalidated)
+                        root = clone(tree.root, nullptr);
+                        thread_tree();
+                        tree.clear();
+                    }
+                    n_nodes = tree.n_nodes;
+                    n_out_of_balance = tree.n_out_of_balance;
+                    tree.n_nodes = 0;
+                    tree.n_out_of_balance = 0;
+                    return *this;
+                }
+
+                alloc_type get_allocator() const { return alloc_type(alloc); }
+
+                //Split and join, for avl_balanced trees
+                //Move the keys not less than x to a new tree ==> auto right = tree.split(key);
+                //O(log n) with order_statistics, otherwise the smaller part is also counted
+                Bst split(const key_type& x);
+                //Move to this tree all the nodes of a tree whose keys are greater than ours, in O(log n) 
+                //==> left.join(std::move(right)); std::invalid_argument is thrown if the keys overlap
+                void join(Bst&& right);
+
+                //Set operations, for avl_balanced trees: the nodes are relinked, the ones left over are freed
+                //and the other tree is left empty. m being the size of the smaller tree, they take 
+                //O(m log(n/m + 1)); given a pool the two halves of every step are processed in parallel
+                //(the nodes are freed concurrently, so an allocator other than std::allocator keeps it serial).
+                //With threaded the in-order links are rebuilt at the end, in O(n).
+                //Keys of both trees; for a key in both, our pair is kept ==> tree.merge_union(std::move(other));
+                void merge_union(Bst&& other) { set_operation(other, set_union, nullptr); }
+                void merge_union(Bst&& other, thread_pool& pool) { set_operation(other, set_union, &pool); }
+                //Our keys which are also in the other tree ==> tree.intersection(std::move(other));
+                void intersection(Bst&& other) { set_operation(other, set_intersection, nullptr); }
+                void intersection(Bst&& other, thread_pool& pool) { set_operation(other, set_intersection, &pool); }
+                //Our keys which are not in the other tree ==> tree.difference(std::move(other));
+                void difference(Bst&& other) { set_operation(other, set_difference, nullptr); }
+                void difference(Bst&& other, thread_pool& pool) { set_operation(other, set_difference, &pool); }
 
                 //iterator functions           
                 using iterator = __iterator<node_type, pair_type>;
 			    using const_iterator = __iterator<node_type, const pair_type>;
 
                 iterator begin() noexcept { 
-				node_type* x = root.get();
-				while(x->left)
-					x = x->left.get();
-				return iterator(x); 
+				node_type* x = root;
+				while(x && x->left)
+					x = x->left;
+				return iterator(x, &root); 
                 }
-                iterator end() noexcept { return iterator{nullptr}; }
+                iterator end() noexcept { return iterator{nullptr, &root}; }
 
                 const_iterator begin() const { 
-                    node_type* x = root.get();
-                    while(x->left)
-                        x = x->left.get();
-                    return const_iterator(x); 
+                    node_type* x = root;
+                    while(x && x->left)
+                        x = x->left;
+                    return const_iterator(x, &root); 
                 }
-                const_iterator end() const { return const_iterator{nullptr}; }
+                const_iterator end() const { return const_iterator{nullptr, &root}; }
 
                 const_iterator cbegin() const { 
-                    node_type* x = root.get();
-                    while(x->left)
-                        x = x->left.get();
-                    return const_iterator(x); 
+                    node_type* x = root;
+                    while(x && x->left)
+                        x = x->left;
+                    return const_iterator(x, &root); 
                 }
-                const_iterator cend() const { return const_iterator{nullptr}; }
+                const_iterator cend() const { return const_iterator{nullptr, &root}; }
+
+                //reverse iterators, from the last key to the first ==> for(auto it = tree.rbegin(); it != tree.rend(); ++it)
+                using reverse_iterator = std::reverse_iterator<iterator>;
+                using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+                reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+                reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+                const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+                const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+                const_reverse_iterator crbegin() const { return const_reverse_iterator(cend()); }
+                const_reverse_iterator crend() const { return const_reverse_iterator(cbegin()); }
 
 
                 //Operations on the tree
                 
+                //Heterogeneous lookup: when comp_op has a member type is_transparent (as std::less<>), the lookups
+                //below also take any key the comparator compares with key_type, without building a key_type
+                //==> Bst<std::string, int, std::less<>> tree; tree.find("key");
+
                 //find a value 
-                iterator find(const key_type& x);
-				const_iterator find(const key_type& x) const;
+                iterator find(const key_type& x) { return iterator(accessed(find_node(x)), &root); }
+				const_iterator find(const key_type& x) const { return const_iterator(find_node(x), &root); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                iterator find(const K& x) { return iterator(accessed(find_node(x)), &root); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                const_iterator find(const K& x) const { return const_iterator(find_node(x), &root); }
+                //Number of pairs with the key x (0 or 1) ==> tree.count(key), tree.contains(key)
+                size_t count(const key_type& x) const { return find_node(x) ? 1 : 0; }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                size_t count(const K& x) const { return find_node(x) ? 1 : 0; }
+                bool contains(const key_type& x) const { return find_node(x) != nullptr; }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                bool contains(const K& x) const { return find_node(x) != nullptr; }
+
+                //First key not less than x, end() if there is none ==> tree.lower_bound(key)
+                iterator lower_bound(const key_type& x) { return iterator(lower_node(x), &root); }
+                const_iterator lower_bound(const key_type& x) const { return const_iterator(lower_node(x), &root); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                iterator lower_bound(const K& x) { return iterator(lower_node(x), &root); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                const_iterator lower_bound(const K& x) const { return const_iterator(lower_node(x), &root); }
+                //First key greater than x, end() if there is none ==> tree.upper_bound(key)
+                iterator upper_bound(const key_type& x) { return iterator(upper_node(x), &root); }
+                const_iterator upper_bound(const key_type& x) const { return const_iterator(upper_node(x), &root); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                iterator upper_bound(const K& x) { return iterator(upper_node(x), &root); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                const_iterator upper_bound(const K& x) const { return const_iterator(upper_node(x), &root); }
+                //The range of the keys equivalent to x (at most one) ==> tree.equal_range(key)
+                std::pair<iterator, iterator> equal_range(const key_type& x) { return {lower_bound(x), upper_bound(x)}; }
+                std::pair<const_iterator, const_iterator> equal_range(const key_type& x) const { return {lower_bound(x), upper_bound(x)}; }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                std::pair<iterator, iterator> equal_range(const K& x) { return {lower_bound(x), upper_bound(x)}; }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                std::pair<const_iterator, const_iterator> equal_range(const K& x) const { return {lower_bound(x), upper_bound(x)}; }
+
+                //Call fn(pair) on every pair with a key in [lo, hi), in order ==> tree.for_each_in_range(lo, hi, fn);
+                //Only the path to lo and the nodes of the range are visited
+                template <class Fn>
+                void for_each_in_range(const key_type& lo, const key_type& hi, Fn fn) { range_aux(*this, lo, hi, fn); }
+                template <class Fn>
+                void for_each_in_range(const key_type& lo, const key_type& hi, Fn fn) const { range_aux(*this, lo, hi, fn); }
+                template <class K, class L, class Fn, class C = comp_op, class = typename C::is_transparent>
+                void for_each_in_range(const K& lo, const L& hi, Fn fn) { range_aux(*this, lo, hi, fn); }
+                template <class K, class L, class Fn, class C = comp_op, class = typename C::is_transparent>
+                void for_each_in_range(const K& lo, const L& hi, Fn fn) const { range_aux(*this, lo, hi, fn); }
+
+                //Call fn(pair) on every pair, in parallel on the threads of the pool and in no particular order
+                //==> tree.parallel_for_each([](std::pair<const k, v>& x){ ... });
+                template <class Fn>
+                void parallel_for_each(Fn fn, thread_pool& pool = thread_pool::shared()){ 
+                    parallel_aux(pool, [](size_t){}, [&](size_t, node_type* x){ fn(x->value); });
+                }
+                template <class Fn>
+                void parallel_for_each(Fn fn, thread_pool& pool = thread_pool::shared()) const{ 
+                    parallel_aux(pool, [](size_t){}, [&](size_t, node_type* x){ fn(static_cast<const pair_type&>(x->value)); });
+                }
+                //Reduce the pairs in parallel ==> tree.parallel_reduce(0, [](const std::pair<const k, v>& x){ return x.second; }, std::plus<int>());
+                //The result is init combined with the map of every pair, in the order of the keys: combine must be 
+                //associative but not commutative, and the result only depends on the content and shape of the tree.
+                template <class T, class Map, class Combine>
+                T parallel_reduce(T init, Map map, Combine combine, thread_pool& pool = thread_pool::shared()) const;
+
+                //find many keys at once ==> tree.find_many(keys.begin(), keys.end(), its.begin());
+                //the iterator to the i-th key (or end()) is written at out[i]
+                template <class RandomIt, class OutIt>
+                void find_many(RandomIt first, RandomIt last, OutIt out) { 
+                    find_many_aux(first, last, [&](size_t i, node_type* x){ out[i] = iterator(x, &root); }); 
+                }
+                template <class RandomIt, class OutIt>
+                void find_many(RandomIt first, RandomIt last, OutIt out) const { 
+                    find_many_aux(first, last, [&](size_t i, node_type* x){ out[i] = const_iterator(x, &root); }); 
+                }
 
                 //insert a value  ==> tree.insert({key,value})
                 std::pair<iterator, bool> insert(const pair_type& x);
                 std::pair<iterator, bool> insert(pair_type&& x);
 
+                //insert a batch of pairs ==> tree.insert_batch(v); 
+                //returns for every pair (in the order of the batch) whether it was inserted
+                template <class Range>
+                std::vector<bool> insert_batch(const Range& batch) { return batch_aux(batch, [](value_type&, const value_type&){}, false); }
+                //insert or update a batch of pairs ==> tree.upsert_batch(v, [](value_type& old, const value_type& x){ old += x; });
+                //merge_fn(old, x) is called when the key is already in the tree; returns true for the inserted pairs, false for the updated ones
+                template <class Range, class Merge>
+                std::vector<bool> upsert_batch(const Range& batch, Merge merge_fn) { return batch_aux(batch, merge_fn, true); }
+
 				//Insert values both as pair_type or key_type,value_type
+                //The pair is built once, in the node; if the key is already there the node is freed
                 template<class... Types>
-			    std::pair<iterator,bool> emplace(Types&&... args) {return insert(pair_type(std::forward<Types>(args)...));}; 
+			    std::pair<iterator,bool> emplace(Types&&... args){
+                    node_type* x = create_node(construct_tag{}, std::forward<Types>(args)...);
+                    node_type* parent;
+                    int side;
+                    node_type* found = find_slot(x->value.first, parent, side);
+                    if(found){
+                        destroy_node(x);
+                        return {iterator(found, &root), false};
+                    }
+                    return {iterator(link_node(x, parent, side), &root), true};
+                }
+                //Insert the pair (k, value_type(args...)) if k is not in the tree, nothing is built or allocated
+                //otherwise ==> tree.try_emplace(key, args...)
+                template <class... Args>
+                std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args) { return try_emplace_aux(k, std::forward<Args>(args)...); }
+                template <class... Args>
+                std::pair<iterator, bool> try_emplace(key_type&& k, Args&&... args) { return try_emplace_aux(std::move(k), std::forward<Args>(args)...); }
+                //Find the key x, inserting (x, value_type{}) if it is not there, in a single descent 
+                //==> tree.find_or_insert(key), the bool tells whether the key was inserted
+                std::pair<iterator, bool> find_or_insert(const key_type& x) { return try_emplace_aux(x); }
+                std::pair<iterator, bool> find_or_insert(key_type&& x) { return try_emplace_aux(std::move(x)); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                std::pair<iterator, bool> find_or_insert(const K& x) { return try_emplace_aux(x); }
+
+                //Insert with a hint: x is expected right before the hint (as for std::map) or right after it,
+                //e.g. end() or the iterator of the previous insert for increasing keys. Then the descent from 
+                //the root is skipped: O(1) amortized with avl_balanced, plus the step to the neighbour of the 
+                //hint without threaded (up to the height of the tree). Otherwise it is a plain insert.
+                //Returns the iterator to the key ==> it = tree.insert(it, {key,value});
+                iterator insert(const_iterator hint, const pair_type& x){
+                    node_type* parent;
+                    int side;
+                    node_type* found = find_slot_near(hint.getCurrent(), x.first, parent, side);
+                    if(found)
+                        return iterator(found, &root);
+                    return iterator(link_node(create_node(x), parent, side), &root);
+                }
+                iterator insert(const_iterator hint, pair_type&& x){
+                    node_type* parent;
+                    int side;
+                    node_type* found = find_slot_near(hint.getCurrent(), x.first, parent, side);
+                    if(found)
+                        return iterator(found, &root);
+                    return iterator(link_node(create_node(std::move(x)), parent, side), &root);
+                }
+                //emplace with a hint, as insert(hint, x) ==> it = tree.emplace_hint(it, key, value);
+                template <class... Types>
+                iterator emplace_hint(const_iterator hint, Types&&... args){
+                    node_type* x = create_node(construct_tag{}, std::forward<Types>(args)...);
+                    node_type* parent;
+                    int side;
+                    node_type* found = find_slot_near(hint.getCurrent(), x->value.first, parent, side);
+                    if(found){
+                        destroy_node(x);
+                        return iterator(found, &root);
+                    }
+                    return iterator(link_node(x, parent, side), &root);
+                }
+
+                //A node taken out of a tree by extract. It owns the pair until it is inserted again,
+                //and frees it if it is not: move it between trees ==> other.insert(tree.extract(key));
+                class node_handle{
+                    node_type* x;
+                    union { node_alloc alloc; };					//alive only while the handle holds a node
+                    friend class Bst;
+
+                    node_handle(node_type* n, const node_alloc& a): x{n} { new (&alloc) node_alloc(a); }
+                    const node_alloc& get_allocator() const noexcept { return alloc; }
+                    //Give the node away, the handle is empty afterwards
+                    node_type* release() noexcept{
+                        node_type* n = x;
+                        alloc.~node_alloc();
+                        x = nullptr;
+                        return n;
+                    }
+
+                    public:
+                        node_handle() noexcept: x{nullptr} {}
+                        node_handle(node_handle&& h) noexcept: x{h.x} {
+                            if(x){
+                                new (&alloc) node_alloc(std::move(h.alloc));
+                                h.release();
+                            }
+                        }
+                        node_handle& operator=(node_handle&& h) noexcept{
+                            if(this != &h){
+                                reset();
+                                if(h.x){
+                                    new (&alloc) node_alloc(std::move(h.alloc));
+                                    x = h.release();
+                                }
+                            }
+                            return *this;
+                        }
+                        ~node_handle() { reset(); }
+
+                        bool empty() const noexcept { return !x; }
+                        explicit operator bool() const noexcept { return x != nullptr; }
+                        const key_type& key() const noexcept { return x->value.first; }
+                        value_type& mapped() const noexcept { return x->value.second; }
+                        //Free the node held, if any
+                        void reset() noexcept{
+                            if(!x)
+                                return;
+                            node_alloc a{std::move(alloc)};
+                            node_traits::destroy(a, x);
+                            node_traits::deallocate(a, release(), 1);
+                        }
+                };
+                //Result of insert(node_handle&&): where the key is, whether the node was inserted,
+                //and the node itself if it was not
+                struct insert_return_type{
+                    iterator position;
+                    bool inserted;
+                    node_handle node;
+                };
+                //Take the node of the key x out of the tree, an empty handle if x is not there ==> auto h = tree.extract(key);
+                node_handle extract(const key_type& x) { return extract_node(find_node(x)); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                node_handle extract(const K& x) { return extract_node(find_node(x)); }
+                node_handle extract(const_iterator pos) { return extract_node(pos.getCurrent()); }
+                //Insert the node of a handle, from a tree with an equal allocator (std::invalid_argument otherwise)
+                //==> tree.insert(std::move(handle))
+                insert_return_type insert(node_handle&& h);
+
+            private:
+            //Take the node a (if not nullptr) out of the tree into a handle
+            node_handle extract_node(node_type* a) noexcept;
+            //Insert a node built from args if the key k is not in the tree, see try_emplace
+            template <class K, class... Args>
+            std::pair<iterator, bool> try_emplace_aux(K&& k, Args&&... args){
+                node_type* parent;
+                int side;
+                node_type* found = find_slot(k, parent, side);
+                if(found)
+                    return {iterator(accessed(found), &root), false};
+                node_type* x = create_node(construct_tag{}, std::piecewise_construct, std::forward_as_tuple(std::forward<K>(k)), 
+                                           std::forward_as_tuple(std::forward<Args>(args)...));
+                return {iterator(link_node(x, parent, side), &root), true};
+            }
+
+            public:
 
-				//To check if the tree is balanced or not
-				bool check_balance() noexcept { return isBalanced(root.get()); }
+				//To check if the tree is balanced or not: O(1) with avl_balanced (it always is) and with
+				//cached_height<unbalanced> (its nodes out of balance are counted). Otherwise a single O(n) walk,
+				//which splay_balanced skips when the height kept in the root is too large for the size of the tree.
+				bool check_balance(){
+                    if(std::is_base_of<avl_balanced, balance_policy>::value)
+                        return true;
+                    if(balance_counted)
+                        return n_out_of_balance == 0;
+                    if(heights_kept && too_tall(n_nodes, node_height(root)))
+                        return false;
+                    return isBalanced(root);
+                }
+                //Height of the tree (0 if it is empty) ==> tree.height()
+                //O(1) with avl_balanced, splay_balanced and cached_height, O(n) otherwise
+                size_t height() noexcept { return heights_kept ? node_height(root) : height(root); }
+                //Size, height and number of nodes at each depth in one O(n) walk, and the counters
+                //of the operations with BST_STATS ==> tree.stats()
+                tree_stats stats() const;
+                //Set the counters of the operations back to zero ==> tree.reset_stats()
+                void reset_stats() noexcept { counters.reset(); }
+                //Number of keys in the tree ==> tree.size()
+                size_t size() const noexcept { return n_nodes; }
+                bool empty() const noexcept { return n_nodes == 0; }
+
+                //Order statistics, available with the order_statistics policy
+                //Number of keys less than x ==> tree.rank(key)
+                size_t rank(const key_type& x) const { return rank_aux(x); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                size_t rank(const K& x) const { return rank_aux(x); }
+                //The k-th smallest key (from 0), end() if k >= size() ==> tree.select(k)
+                iterator select(size_t k) noexcept { return iterator(select_node(k), &root); }
+                const_iterator select(size_t k) const noexcept { return const_iterator(select_node(k), &root); }
+                //Number of keys in [lo, hi) ==> tree.count_range(lo, hi)
+                size_t count_range(const key_type& lo, const key_type& hi) const{
+                    if(!compare(lo, hi))
+                        return 0;
+                    return rank_aux(hi) - rank_aux(lo);
+                }
+                template <class K, class L, class C = comp_op, class = typename C::is_transparent>
+                size_t count_range(const K& lo, const L& hi) const{
+                    if(!compare(lo, hi))
+                        return 0;
+                    return rank_aux(hi) - rank_aux(lo);
+                }
                 //Balance the tree ==> tree.balance();
                 void balance();                
+                //Replace the content of the tree with a range of pairs sorted by key ==> tree.assign_sorted(v.begin(), v.end());
+                template <class It>
+                void assign_sorted(It first, It last, bool checked = true);
+                //Write the tree to a binary file, see serializer.hpp ==> tree.save("tree.bst");
+                template <class key_io = serializer<key_type>, class value_io = serializer<value_type>>
+                void save(const std::string& path) const;
+                //Replace the content of the tree with a file written by save ==> tree.load("tree.bst");
+                //Unchanged if the header of the file is rejected, empty if a record is
+                template <class key_io = serializer<key_type>, class value_io = serializer<value_type>>
+                void load(const std::string& path);
+                //Replace the content of the tree with a range of pairs in any order, using threads threads
+                //==> tree.build_parallel(v.begin(), v.end(), 8);
+                //The pairs are sorted and the balanced tree is allocated and linked in parallel.
+                //Of the pairs with the same key the first one is kept, unless merge_fn(kept, other) is given:
+                //it is then called with the values of the others, in the order of the range.
+                template <class It>
+                void build_parallel(It first, It last, size_t threads = std::thread::hardware_concurrency()) { 
+                    build_parallel(first, last, threads, [](value_type&, const value_type&){}); 
+                }
+                template <class It, class Merge>
+                void build_parallel(It first, It last, size_t threads, Merge merge_fn);
                 //Clear the entire tree ==> tree.clear();
-                void clear() noexcept { if(root) root.reset(); }
+                //With a pool allocator and trivially destructible pairs the pool is freed at once 
+                void clear() noexcept { 
+                    if(!root)
+                        return;
+                    if(!std::is_trivially_destructible<pair_type>::value || !release_pool(alloc, n_nodes, 0))
+                        destroy_subtree(root);
+                    else
+                        counters.freed(n_nodes);
+                    root = nullptr;
+                    n_nodes = 0;
+                    n_out_of_balance = 0;
+                }
                 //Erase the node associated with the particular key x ==> tree.erase(key)
-                void erase(const key_type& x);
+                void erase(const key_type& x) { erase_aux(x); }
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                void erase(const K& x) { erase_aux(x); }
                 //Perform a bfs traversal on the tree and print the nodes ==> tree.bfs
                 void bfs();
 
                 //Operator overloading
-                value_type& operator[](const key_type& x){
-                    auto it = find(x);
-                    if(it == end()){
-                        auto t = insert({x,value_type{}});			
-                        it = t.first;
-                    }
-                    return (*it).second;
-                }
-                value_type& operator[](key_type&& x){
-                    auto it = find(x);
-                    if(it == end()){
-                        auto t = insert({std::move(x),value_type{}});
-                        it = t.first;
-                    }
-                    return (*it).second;
-                }
+                //A single descent, see find_or_insert
+                value_type& operator[](const key_type& x) { return (*find_or_insert(x).first).second; }
+                value_type& operator[](key_type&& x) { return (*find_or_insert(std::move(x)).first).second; }
+                //With a transparent comparator the key_type is built from x only if x is not in the tree
+                template <class K, class C = comp_op, class = typename C::is_transparent>
+                value_type& operator[](const K& x) { return (*find_or_insert(x).first).second; }
                 //on printing the tree, the tree follows inorder traversal.
                 friend std::ostream& operator<<(std::ostream& os, const Bst& tree){
                     auto it = tree.cbegin();
@@ -209,183 +1079,1111 @@ template <typename key_type, typename value_type, typename comp_op = std::less<k
 *an iterator pointing to the inserted key(if inserted otherwise shows a nullptr) 
 *and boolean value telling whether the key is sucessfully inserted or not
 */
-template <typename key_type, typename value_type, typename comp_op>
-	std::pair<typename Bst<key_type, value_type, comp_op>::iterator, bool> Bst<key_type, value_type, comp_op>::insert(const pair_type& x){
-		node_type* tmp = root.get();
-		if(!tmp){ // if the tree is empty, make the inserted pair as the root
-			root = std::make_unique<node_type>(x);
-			return std::make_pair<iterator,bool>(iterator(root.get()), true);
-		}
-		node_type* new_node = new node_type(x); //if not, form a new node
-		while (tmp) //until we reach the end of the tree
-		{
-			if(compare(x.first,tmp->value.first)){ // Compare the new node with the root (comapring the key values)
-				if(!tmp->left){					   // according to the comparison operator of the tree
-					new_node->parent = tmp; 	   // Move to right child if it is greater(for std::less comparison)
-					tmp->left.reset(new_node);	   // else move to the left child and repeat the same until reaching 
-					return std::make_pair<iterator,bool>(iterator(new_node), true); // the end of the tree (i.e. nullptr)
-				}
-				tmp = tmp->left.get();				
-			}
-			else if (compare(tmp->value.first, x.first)){
-				if(!tmp->right){
-					new_node->parent = tmp;			// Set the parent for the new node and set the new node as the child of 
-					tmp->right.reset(new_node);		//parent node.
-					return std::make_pair<iterator,bool>(iterator(new_node), true);
-				}
-				tmp = tmp->right.get();
-			}
-			else 
-				return std::make_pair<iterator,bool>(iterator(tmp), false);
-		}
-		return std::make_pair<iterator,bool>(iterator(tmp), false);
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	std::pair<typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::iterator, bool> Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::insert(const pair_type& x){
+		node_type* parent;
+		int side;
+		node_type* found = find_slot(x.first, parent, side);
+		if(found)										//the key is already there: nothing is allocated
+			return std::make_pair<iterator,bool>(iterator(accessed(found), &root), false);
+		node_type* new_node = create_node(x);			//if not, form a new node in the free place
+		return std::make_pair<iterator,bool>(iterator(link_node(new_node, parent, side), &root), true);
 }
 
 // The following function is the same insert operation when the key and value are to be moved
 
-template <typename key_type, typename value_type, typename comp_op>
-	std::pair<typename Bst<key_type, value_type, comp_op>::iterator, bool> Bst<key_type, value_type, comp_op>::insert(pair_type&& x){
-		if(!root){
-			root = std::make_unique<node_type>(std::move(x));
-			return std::make_pair<iterator,bool>(iterator(root.get()), true);
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	std::pair<typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::iterator, bool> Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::insert(pair_type&& x){
+		node_type* parent;
+		int side;
+		node_type* found = find_slot(x.first, parent, side);
+		if(found)
+			return std::make_pair<iterator,bool>(iterator(accessed(found), &root), false);
+		node_type* new_node = create_node(std::move(x));
+		return std::make_pair<iterator,bool>(iterator(link_node(new_node, parent, side), &root), true);
+}
+
+//The descent shared by the inserts: the node of the key x, or nullptr with the place where x goes
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+template <class K>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::find_slot(const K& x, node_type*& parent, int& side) const{
+		op_scope<bst_stats> scope{counters, op_kind::insert};
+		parent = nullptr;								//an empty tree: the new node is the root
+		side = -1;
+		node_type* tmp = root;
+		while(tmp){										//until we reach the end of the tree
+			if(compare(x, tmp->value.first)){			// Compare the key with the one of the node
+				parent = tmp;							// (according to the comparison operator of the tree)
+				side = 0;								// and move to the left child if it is less (for std::less)
+				tmp = tmp->left;
+			}else if(compare(tmp->value.first, x)){		// or to the right child if it is greater
+				parent = tmp;
+				side = 1;
+				tmp = tmp->right;
+			}else
+				return tmp;
 		}
-		node_type* new_node = new node_type(std::move(x));
-		node_type* tmp = root.get();
-		while (tmp)
-		{
-			if(compare(x.first,tmp->value.first)){
-				if(!tmp->left){
-					new_node->parent = tmp;
-					tmp->left.reset(new_node);
-					return std::make_pair<iterator,bool>(iterator(new_node),true);
+		return nullptr;
+}
+
+//If x goes between the predecessor and the successor of the hint, its place is next to the hint:
+//the free child of the hint on that side, or else the free child of the neighbour facing the hint.
+//With threaded the neighbours are one step away, otherwise up to a climb of the height of the tree.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+template <class K>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::find_slot_near(node_type* hint, const K& x, node_type*& parent, int& side) const{
+		op_scope<bst_stats> scope{counters, op_kind::insert};
+		if(!root)
+			return find_slot(x, parent, side);
+		const_iterator next{hint, &root};
+		if(!hint || compare(x, hint->value.first)){					//right before the hint?
+			const_iterator prev = next;
+			--prev;													//nullptr before the first node
+			if(!prev.getCurrent() || compare((*prev).first, x)){
+				if(hint && !hint->left){
+					parent = hint;
+					side = 0;
+				}else{												//the predecessor has no right child
+					parent = prev.getCurrent();
+					side = 1;
 				}
-				tmp = tmp->left.get();
+				return nullptr;
 			}
-			else if (compare(tmp->value.first, x.first)){
-				if(!tmp->right){
-					new_node->parent = tmp;					
-					tmp->right.reset(new_node);
-					return std::make_pair<iterator,bool>(iterator(new_node),true);
+		}else if(compare(hint->value.first, x)){						//right after the hint?
+			++next;
+			if(next == cend() || compare(x, (*next).first)){
+				if(!hint->right){
+					parent = hint;
+					side = 1;
+				}else{												//the successor has no left child
+					parent = next.getCurrent();
+					side = 0;
 				}
-				tmp = tmp->right.get();
+				return nullptr;
 			}
-			else 
-				return std::make_pair<iterator,bool>(iterator(tmp), false);
+		}else
+			return hint;
+		return find_slot(x, parent, side);
+}
+
+//Hang a new node below the parent on the side found by find_slot, then let the balancing policy
+//fix the path up to the root
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::link_node(node_type* x, node_type* parent, int side) noexcept{
+		++n_nodes;
+		if(!parent){
+			root = x;
+			return x;
 		}
-		return std::make_pair<iterator,bool>(iterator(tmp), false);
+		x->parent = parent;							// Set the parent for the new node and set the new node as the child of 
+		reset_child(parent, x, side);				//parent node.
+		if(side == 0) x->link_before(parent);		//(and next to it in the order, with threaded)
+		else x->link_after(parent);
+		rebalance(splayed ? x : parent);			//(splay_balanced brings up the new node itself)
+		return x;
 }
+
+/*
+********* EXTRACT AND NODE HANDLES **********
+* extract takes the node out of the tree as erase does, but hands it over in a node_handle
+* instead of freeing it; insert(node_handle&&) links it again, in this tree or in another one
+* sharing the allocator. The pair is neither copied nor moved, no node is allocated.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_handle Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::extract_node(node_type* a) noexcept{
+		if(!a)
+			return node_handle();
+		detach_node(a);
+		a->parent = nullptr;							//back to a lone node, ready to be linked again
+		a->left = nullptr;
+		a->right = nullptr;
+		a->height = 1;
+		a->set(1);
+		a->set_links(nullptr, nullptr);
+		return node_handle(a, alloc);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::insert_return_type Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::insert(node_handle&& h){
+		if(h.empty())
+			return {end(), false, node_handle()};
+		if(!(h.get_allocator() == alloc))
+			throw std::invalid_argument("insert: the node was allocated by another allocator");
+		node_type* parent;
+		int side;
+		node_type* found = find_slot(h.key(), parent, side);
+		if(found)										//the handle keeps the node
+			return {iterator(found, &root), false, std::move(h)};
+		return {iterator(link_node(h.release(), parent, side), &root), true, node_handle()};
+}
+
 /*
 ********* 2. FIND **********
 * The find function is used to locate a key in the tree
 It takes as input a key and returns an iterator to the found key.
 If the key is not found, it returns a nullptr
 */
-template <typename key_type, typename value_type, typename comp_op>
-	typename Bst<key_type, value_type, comp_op>::iterator Bst<key_type, value_type, comp_op>::find(const key_type& x){
-		node_type* tmp = root.get();
+// find and its const version wrap the node found in an iterator (end() if it is nullptr).
+// With a transparent comparator x can be of any type K compared with the keys, nothing is built.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+template <class K>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::find_node(const K& x) const{
+		op_scope<bst_stats> scope{counters, op_kind::find};
+		node_type* tmp = root;
 		while(tmp){										//Start from the root
 			if(compare(x,tmp->value.first)){			//Compare the the key with the root key
-				tmp = tmp->left.get();					//Move left if the key < root key (for std::less)
+				tmp = tmp->left;					//Move left if the key < root key (for std::less)
 			}else if(compare(tmp->value.first, x)){		//Move right if key > root
-				tmp = tmp->right.get();					// Repeat it iteratively until we reach the end
+				tmp = tmp->right;					// Repeat it iteratively until we reach the end
 			}else										// or find the key
 			{
-				return iterator(tmp);					
+				return tmp;					
 			}
 			
 		}
-		return end(); // If key not found return the nullptr
+		return nullptr; // If key not found return the nullptr
 } 
 
-// The following function works the same way but returns a constant iterator
-
-template <typename key_type, typename value_type, typename comp_op>
-	typename Bst<key_type, value_type, comp_op>::const_iterator Bst<key_type, value_type, comp_op>::find(const key_type& x) const{
-		node_type* tmp = root.get();
-		while(tmp){
-			if(compare(x,tmp->value.first)){
-				tmp = tmp->left.get();
-			}else if(compare(tmp->value.first, x)){
-				tmp = tmp->right.get();
-			}else
-			{
-				return const_iterator(tmp);
+/*
+********* FIND MANY **********
+* Looks up many keys at once. A single find waits for the cache miss of each node in turn;
+* here up to find_group lookups are walked in lockstep (AMAC style): each one takes a step,
+* prefetches the child it moves to and leaves the place to the next lookup, so that by the
+* time it is resumed the child is in cache and the misses of the different keys overlap.
+* When a lookup ends, its slot starts the next key.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class RandomIt, class Found>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::find_many_aux(RandomIt first, RandomIt last, Found found) const{
+		size_t m = last - first;
+		size_t next = 0;
+		node_type* cur[find_group];				//the node each lookup is at
+		size_t idx[find_group];					//the key each lookup is for
+		int slots = 0;
+		for(; slots < find_group && next < m; slots++){
+			cur[slots] = root;
+			idx[slots] = next++;
+		}
+		int active = slots;
+		while(active){
+			for(int s = 0; s < slots; s++){
+				if(idx[s] == m)						//nothing left to start in this slot
+					continue;
+				node_type* x = cur[s];
+				const key_type& k = first[idx[s]];
+				bool done = true;
+				if(x){
+					if(compare(k, x->value.first)){
+						x = x->left;
+						done = !x;
+					}else if(compare(x->value.first, k)){
+						x = x->right;
+						done = !x;
+					}
+				}
+				if(!done){							//one step down, the node is fetched while
+#if defined(__GNUC__)
+					__builtin_prefetch(x);			//the other lookups take their step
+#endif
+					cur[s] = x;
+					continue;
+				}
+				found(idx[s], x);					//x is the node of the key, or nullptr
+				if(next < m){
+					cur[s] = root;
+					idx[s] = next++;
+				}else{
+					idx[s] = m;
+					--active;
+				}
 			}
-			
 		}
-		return cend();
-} 
+}
 
 /*
 ********** 3. BALANCE ***********
 * Used to balance the tree.
-* Needs some auxillary functions ==> a.height; b. isBalanced; c.balance_aux
+* Needs some auxillary functions ==> a.height; b. isBalanced; c.tree_to_vine; d.vine_to_tree
 * Works as tree.balance()
 */
 
 //The auxillary functions
 // ** a. height ** Used to calculate the height of the tree from a given node 
-template <typename key_type, typename value_type, typename comp_op>
-	size_t Bst<key_type, value_type, comp_op>::height(node_type* x) noexcept{
-		if(x){
-			return 1+std::max(height(x->left.get()), height(x->right.get()));
+//The subtree is walked through the parent pointers (no recursion), tracking the depth of the current node.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	size_t Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::height(node_type* x) noexcept{
+		size_t h = 0;
+		size_t depth = 0;
+		node_type* top = x;
+		node_type* from = x ? x->parent : nullptr;		//the node we come from tells what is left to visit
+		while(x){
+			node_type* next = nullptr;
+			if(from == x->parent){						//first visit, coming from above
+				h = std::max(h, ++depth);
+				next = x->left ? x->left : x->right;
+			}else if(from == x->left){					//back from the left subtree
+				next = x->right;
+			}
+			if(next){
+				from = x;
+				x = next;
+			}else{										//both subtrees done, go back up
+				--depth;
+				from = x;
+				x = (x == top) ? nullptr : x->parent;
+			}
 		}
-		return 0;
+		return h;
 }
 
 // ** b. isBalanced ** To check if the tree is balanced or not. 
 //Balanced tree ==> the difference in heightbetween the right and left subtrees do not exceed by 1
-template <typename key_type, typename value_type, typename comp_op>
-	bool Bst<key_type, value_type, comp_op>::isBalanced(node_type* x) noexcept{
-		if(!x){
-			return 1;
-		}
-		size_t left_height, right_height;
-		left_height = height(x->left.get());
-		right_height = height(x->right.get());
-		if(abs(left_height - right_height)<=1 && isBalanced(x->left.get()) && isBalanced(x->right.get()))
-			return 1;
-		
-		return 0;
-}
-
-//** c. balance_aux ** mainly does the balance operation.
-//Takes as input a vector of pair_type values and builds the balanced tree
-template <typename key_type, typename value_type, typename comp_op>
-	void Bst<key_type, value_type, comp_op>::balance_aux(std::vector<pair_type> v_balance, size_t size){
-		if(size == 1){
-			insert(v_balance.at(0));				//if the vector contains only one or two nodes insert them
-		}else if (size == 2){
-			insert(v_balance.at(1));
-			insert(v_balance.at(0));
-		}else {
-			std::vector<pair_type> v_balance1(v_balance.begin(), v_balance.begin()+size/2); 
-			std::vector<pair_type> v_balance2(v_balance.begin()+size/2+1, v_balance.end());	
-			size = size/2;
-			insert(v_balance.at(size)); //For more than two nodes, pick the middle element of the vector and insert it
-			balance_aux(v_balance1, v_balance1.size()); //Copy the the other nodes into two vectors 
-			balance_aux(v_balance2, v_balance2.size()); //and do the insertion recursively.
+//The nodes are visited in post-order through the parent pointers: when a node is left, the heights of
+//its subtrees are known and its own is computed and checked at once. A single O(n) pass, which stops at
+//the first node out of balance. The heights of the subtrees waiting for their parent are kept on a local
+//stack (the stored ones are read when the policy keeps them exact): the nodes are not written.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	bool Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::isBalanced(node_type* x) const{
+		std::vector<int> done;							//heights of the subtrees done, the right one on top
+		node_type* top = x;
+		node_type* from = x ? x->parent : nullptr;
+		while(x){
+			node_type* next = nullptr;
+			if(from == x->parent){
+				next = x->left ? x->left : x->right;
+			}else if(from == x->left){
+				next = x->right;
+			}
+			if(next){
+				from = x;
+				x = next;
+			}else{										//both subtrees done
+				int right_height = node_height(x->right);
+				int left_height = node_height(x->left);
+				if(!heights_kept){
+					if(x->right){ right_height = done.back(); done.pop_back(); }
+					if(x->left){ left_height = done.back(); done.pop_back(); }
+				}
+				if(std::abs(left_height - right_height) > 1)
+					return false;
+				if(!heights_kept)
+					done.push_back(1 + std::max(left_height, right_height));
+				from = x;
+				x = (x == top) ? nullptr : x->parent;
+			}
+		}
+		return true;
+}
+
+//** c. tree_to_vine ** flattens the tree without allocating: whenever the current node has a left
+//child it is rotated right, otherwise the node is the next one in order and is appended to the vine.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	size_t Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::tree_to_vine(node_type*& head) noexcept{
+		size_t n = 0;
+		node_type* tail = nullptr;
+		node_type* rest = root;
+		root = nullptr;
+		head = nullptr;
+		while(rest){
+			if(rest->left){
+				node_type* l = rest->left;				//rotate right at rest
+				rest->left = l->right;
+				l->right = rest;
+				rest = l;
+			}else{
+				node_type* next = rest->right;
+				rest->right = nullptr;
+				if(tail) tail->right = rest;			//rest has no left child: it is the next node in order
+				else head = rest;
+				tail = rest;
+				rest = next;
+				++n;
+			}
 		}
+		return n;
+}
+
+//** d. vine_to_tree ** rebuilds the nodes of the vine in order: the left half of the nodes becomes the
+//left subtree, the next node the root and the remaining ones the right subtree. Every node is visited once
+//and the recursion depth is log2(n).
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::vine_to_tree(node_type*& head, size_t n) noexcept{
+		if(n == 0)
+			return nullptr;
+		node_type* left = vine_to_tree(head, n/2);
+		node_type* x = head;						//the middle node becomes the root of the subtree
+		head = x->right;
+		x->left = left;
+		if(left) left->parent = x;
+		node_type* right = vine_to_tree(head, n - n/2 - 1);
+		x->right = right;
+		if(right) right->parent = x;
+		pull(x);
+		mark(x);
+		return x;
 }
 
 /*
 ****** BALANCE ******
 Used as tree.balance()
 */
-template <typename key_type, typename value_type, typename comp_op>
-	void Bst<key_type, value_type, comp_op>::balance(){
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::balance(){
+		op_scope<bst_stats> scope{counters, op_kind::balance};
+		if(check_balance())		//if tree is already balanced do nothing
+			return;
+
+		node_type* head;
+		size_t n = tree_to_vine(head);	//else flatten the existing nodes in order 
+		root = vine_to_tree(head, n);		//and relink them into a balanced tree, in O(n) 
+		root->parent = nullptr;				//without copying any pair or reallocating any node
+}
 
-		if(isBalanced(root.get()))		//if tree is already balanced do nothing
+/*
+****** STATS ******
+* The tree is walked once in pre-order through the parent pointers, counting the nodes at each depth;
+* the height is the number of depths. Used as tree.stats()
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	tree_stats Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::stats() const{
+		tree_stats s;
+		s.size = n_nodes;
+		s.ops = counters.get();
+		size_t depth = 0;
+		node_type* x = root;
+		node_type* from = nullptr;
+		while(x){
+			node_type* next = nullptr;
+			if(from == x->parent){						//first visit
+				if(s.depths.size() == depth)
+					s.depths.push_back(0);
+				++s.depths[depth];
+				next = x->left ? x->left : x->right;
+			}else if(from == x->left){
+				next = x->right;
+			}
+			from = x;
+			if(next){
+				x = next;
+				++depth;
+			}else{
+				x = x->parent;
+				--depth;
+			}
+		}
+		s.height = s.depths.size();
+		return s;
+}
+
+//** e. sort_vine ** is used when a range given to assign_sorted turns out not to be sorted.
+//The nodes are sorted (stably, so that the first pair of each key is kept as by insert) and relinked.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	size_t Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::sort_vine(node_type*& head, size_t n){
+		std::vector<node_type*> nodes;
+		nodes.reserve(n);
+		for(node_type* x = head; x; x = x->right)
+			nodes.push_back(x);
+		std::stable_sort(nodes.begin(), nodes.end(), [this](node_type* a, node_type* b){ return compare(a->value.first, b->value.first); });
+		node_type* tail = nullptr;
+		n = 0;
+		for(node_type* x : nodes){
+			if(tail && !compare(tail->value.first, x->value.first)){	//same key as the previous node
+				destroy_node(x);
+				continue;
+			}
+			if(tail) tail->right = x;
+			else head = x;
+			tail = x;
+			++n;
+		}
+		if(tail) tail->right = nullptr;
+		return n;
+}
+
+/*
+****** ASSIGN SORTED ******
+* Builds a balanced tree from a range of pairs sorted by key in O(n), without walking from the root:
+* the nodes are allocated in a single pass, chained in a vine and relinked by vine_to_tree.
+* Used as tree.assign_sorted(first, last) or through the constructor Bst(first, last).
+* In checked mode (the default) a range which is not strictly increasing is sorted first,
+* the first pair of a repeated key is kept. With checked = false the range must be sorted and 
+* without repeated keys.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class It>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::assign_sorted(It first, It last, bool checked){
+		assign_vine([&]() -> node_type* { return first != last ? create_node(*first++) : nullptr; }, checked);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class Next>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::assign_vine(Next next, bool checked){
+		clear();
+		node_type* head = nullptr;
+		node_type* tail = nullptr;
+		size_t n = 0;
+		bool sorted = true;
+		try{
+			while(node_type* x = next()){
+				if(tail){
+					if(checked && sorted && !compare(tail->value.first, x->value.first))
+						sorted = false;				//keep going, the vine is sorted at the end
+					tail->right = x;
+				}else
+					head = x;
+				tail = x;
+				++n;
+			}
+			if(!sorted)
+				n = sort_vine(head, n);
+		}catch(...){
+			while(head){						//give back the nodes created so far
+				node_type* next = head->right;
+				destroy_node(head);
+				head = next;
+			}
+			throw;
+		}
+		thread_vine(head);
+		root = vine_to_tree(head, n);
+		if(root) root->parent = nullptr;
+		n_nodes = n;
+}
+
+/*
+****** SAVE AND LOAD ******
+* save writes the header and then the pairs in order to path.tmp, syncs it and renames it to path,
+* so path holds either the old file or the whole new one. The directory is synced after the rename,
+* otherwise a crash could still bring back the old file (POSIX).
+* load checks the header and streams the records into a vine, which is relinked by vine_to_tree
+* as in assign_sorted: O(n), without a single comparison walk from the root. The records of a file
+* written by save are already sorted; if they are not (another comparator) they are sorted first.
+* If the file cannot be opened or its header is not valid, std::runtime_error is thrown and the tree is
+* left as it was; if a record is not valid or the file ends too early, it is thrown after the tree was
+* cleared, and the tree is left empty.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class key_io, class value_io>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::save(const std::string& path) const{
+		const std::string tmp = path + ".tmp";
+		try{
+			binary_writer out{tmp};
+			const std::uint32_t header[4] = {bst_file::byte_order, bst_file::version, key_io::fixed_size, value_io::fixed_size};
+			const std::uint64_t count = n_nodes;
+			out.write(bst_file::magic, sizeof(bst_file::magic));
+			out.write(header, sizeof(header));
+			out.write(&count, sizeof(count));
+			for(auto it = cbegin(); it != cend(); ++it){
+				key_io::write(out, it->first);
+				value_io::write(out, it->second);
+			}
+			out.close();
+		}catch(...){
+			std::remove(tmp.c_str());
+			throw;
+		}
+		if(std::rename(tmp.c_str(), path.c_str()) != 0){
+			std::remove(tmp.c_str());
+			throw std::runtime_error("bst: cannot rename " + tmp + " to " + path);
+		}
+		bst_file::sync_directory_of(path);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class key_io, class value_io>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::load(const std::string& path){
+		binary_reader in{path};
+		char magic[sizeof(bst_file::magic)];
+		std::uint32_t header[4];
+		std::uint64_t count;
+		in.read(magic, sizeof(magic));
+		in.read(header, sizeof(header));
+		in.read(&count, sizeof(count));
+		if(std::memcmp(magic, bst_file::magic, sizeof(magic)) != 0)
+			throw std::runtime_error("bst: " + path + " is not a tree file");
+		if(header[0] != bst_file::byte_order)
+			throw std::runtime_error("bst: " + path + " was written with another byte order");
+		if(header[1] > bst_file::version)
+			throw std::runtime_error("bst: " + path + " has a newer format version");
+		if(header[2] != key_io::fixed_size || header[3] != value_io::fixed_size)
+			throw std::runtime_error("bst: the records of " + path + " don't match the key and value types");
+		std::uint64_t i = 0;
+		assign_vine([&]() -> node_type* {
+			if(i == count)
+				return nullptr;
+			++i;
+			key_type k = key_io::read(in);				//the key comes first in the record
+			return create_node(construct_tag{}, std::move(k), value_io::read(in));
+		}, true);
+}
+
+/*
+****** SPLIT AND JOIN ******
+* The AVL join of l, k and r: if the heights of l and r differ by at most one, k simply becomes 
+* their parent; otherwise k goes down the right spine of the taller l (or the left spine of r) to the
+* first subtree c not taller than the other tree plus one, takes c and r as children, and the way back
+* up is rebalanced with at most one single or double rotation per level, in O(|h(l) - h(r)|).
+* split walks down to x, and on the way back joins the subtrees left on each side: O(log n).
+* The set operations split one tree by the root of the other and recurse on the two halves,
+* which are independent and can be processed by two tasks.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::attach(node_type* l, node_type* k, node_type* r) noexcept{
+		k->left = l;
+		k->right = r;
+		if(l) l->parent = k;
+		if(r) r->parent = k;
+		k->parent = nullptr;
+		pull(k);
+		return k;
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::detached_left(node_type* x) noexcept{
+		node_type* y = x->right;
+		attach(x->left, x, y->left);
+		return attach(x, y, y->right);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::detached_right(node_type* x) noexcept{
+		node_type* y = x->left;
+		attach(y->right, x, x->right);
+		return attach(y->left, y, x);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::join_right(node_type* l, node_type* k, node_type* r) noexcept{
+		node_type* a = l->left;
+		node_type* c = l->right;
+		if(node_height(c) <= node_height(r) + 1){
+			node_type* t = attach(c, k, r);
+			if(node_height(t) <= node_height(a) + 1)
+				return attach(a, l, t);
+			return detached_left(attach(a, l, detached_right(t)));		//double rotation
+		}
+		node_type* t = join_right(c, k, r);
+		attach(a, l, t);
+		if(node_height(t) <= node_height(a) + 1)
+			return l;
+		return detached_left(l);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::join_left(node_type* l, node_type* k, node_type* r) noexcept{
+		node_type* c = r->left;
+		node_type* b = r->right;
+		if(node_height(c) <= node_height(l) + 1){
+			node_type* t = attach(l, k, c);
+			if(node_height(t) <= node_height(b) + 1)
+				return attach(t, r, b);
+			return detached_right(attach(detached_left(t), r, b));
+		}
+		node_type* t = join_left(l, k, c);
+		attach(t, r, b);
+		if(node_height(t) <= node_height(b) + 1)
+			return r;
+		return detached_right(r);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::join3(node_type* l, node_type* k, node_type* r) noexcept{
+		if(node_height(l) > node_height(r) + 1)
+			return join_right(l, k, r);
+		if(node_height(r) > node_height(l) + 1)
+			return join_left(l, k, r);
+		return attach(l, k, r);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::split_last(node_type* t, node_type*& last) noexcept{
+		if(t->left) t->left->parent = nullptr;
+		if(t->right) t->right->parent = nullptr;
+		if(!t->right){
+			last = t;
+			return t->left;
+		}
+		node_type* rest = split_last(t->right, last);
+		return join3(t->left, t, rest);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::join2(node_type* l, node_type* r) noexcept{
+		if(!l)
+			return r;
+		node_type* last;
+		node_type* rest = split_last(l, last);
+		return join3(rest, last, r);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::split3(node_type* t, const key_type& x, node_type*& l, node_type*& m, node_type*& r){
+		if(!t){
+			l = m = r = nullptr;
+			return;
+		}
+		if(t->left) t->left->parent = nullptr;
+		if(t->right) t->right->parent = nullptr;
+		if(compare(x, t->value.first)){
+			node_type* rl;
+			split3(t->left, x, l, m, rl);
+			r = join3(rl, t, t->right);
+		}else if(compare(t->value.first, x)){
+			node_type* lr;
+			split3(t->right, x, lr, m, r);
+			l = join3(t->left, t, lr);
+		}else{
+			l = t->left;
+			r = t->right;
+			m = attach(nullptr, t, nullptr);
+		}
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	size_t Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::size_of_first(node_type* a, node_type* b, size_t n) noexcept{
+		struct walk{												//pre-order walk through the parent pointers
+			node_type* x;
+			node_type* from;
+			node_type* top;
+			size_t count;
+			walk(node_type* t): x{t}, from{nullptr}, top{t}, count{0} {}
+			bool step() noexcept{									//one edge, false when over
+				if(!x)
+					return false;
+				node_type* next = nullptr;
+				if(from == x->parent){
+					++count;
+					next = x->left ? x->left : x->right;
+				}else if(from == x->left){
+					next = x->right;
+				}
+				from = x;
+				x = next ? next : (x == top ? nullptr : x->parent);
+				return true;
+			}
+		};
+		walk wa{a}, wb{b};
+		while(true){
+			if(!wa.step())
+				return wa.count;
+			if(!wb.step())
+				return n - wb.count;
+		}
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	Bst<key_type, value_type, comp_op, balance_policy, alloc_type> Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::split(const key_type& x){
+		static_assert(std::is_base_of<avl_balanced, balance_policy>::value, "split needs an avl_balanced tree");
+		node_type* l;
+		node_type* m;
+		node_type* r;
+		split3(root, x, l, m, r);
+		if(m)
+			r = join3(nullptr, m, r);								//x is the first key of the right part
+		if(l) l->parent = nullptr;
+		if(r) r->parent = nullptr;
+		size_t n_left = counted ? node_size(l) : size_of_first(l, r, n_nodes);
+		size_t n_right = n_nodes - n_left;
+		if(linked && l){											//cut the in-order links between the parts
+			node_type* last = l;
+			while(last->right)
+				last = last->right;
+			last->cut_after();
+		}
+		root = l;
+		n_nodes = n_left;
+		return Bst(adopt_tag{}, compare, alloc, r, n_right);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::take_nodes(Bst& other, bool& copied){
+		node_type* x;
+		copied = !(alloc == other.alloc);
+		if(copied){
+			x = clone(other.root, nullptr);
+			other.clear();
+		}else{
+			x = other.root;
+			other.root = nullptr;
+		}
+		other.n_nodes = 0;
+		return x;
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::join(Bst&& right){
+		static_assert(std::is_base_of<avl_balanced, balance_policy>::value, "join needs an avl_balanced tree");
+		if(&right == this || !right.root)
+			return;
+		node_type* last = root;
+		while(last && last->right)
+			last = last->right;
+		node_type* first = right.root;
+		while(first->left)
+			first = first->left;
+		if(last && !compare(last->value.first, first->value.first))
+			throw std::invalid_argument("join: the keys of the right tree must follow the keys of the tree");
+		size_t n = right.n_nodes;
+		bool copied;
+		node_type* r = take_nodes(right, copied);
+		root = join2(root, r);
+		root->parent = nullptr;
+		n_nodes += n;
+		if(linked && copied){
+			thread_tree();
+		}else if(linked && last){									//link the two parts
+			last->splice(iterator::successor(last));
+		}
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::set_aux(node_type* a, node_type* b, set_kind kind, thread_pool* pool, int depth, std::atomic<size_t>& found){
+		if(!a || !b){
+			if(kind == set_intersection){
+				destroy_subtree(a);
+				destroy_subtree(b);
+				return nullptr;
+			}
+			if(kind == set_difference){
+				destroy_subtree(b);
+				return a;
+			}
+			return a ? a : b;
+		}
+		node_type* l2 = b->left;									//expose the root of b
+		node_type* r2 = b->right;
+		if(l2) l2->parent = nullptr;
+		if(r2) r2->parent = nullptr;
+		node_type* l1;
+		node_type* m;
+		node_type* r1;
+		split3(a, b->value.first, l1, m, r1);
+		node_type* k = nullptr;										//the node joining the two halves, if any
+		if(m){
+			++found;
+			destroy_node(b);
+			if(kind == set_difference)
+				destroy_node(m);
+			else
+				k = m;												//our pair is kept
+		}else if(kind == set_union){
+			k = b;
+		}else{
+			destroy_node(b);
+		}
+		node_type* tl;
+		node_type* tr;
+		if(pool && depth < parallel_depth){
+			task_group group{*pool};
+			group.run([&]{ tl = set_aux(l1, l2, kind, pool, depth + 1, found); });
+			tr = set_aux(r1, r2, kind, pool, depth + 1, found);
+			group.wait();
+		}else{
+			tl = set_aux(l1, l2, kind, pool, depth + 1, found);
+			tr = set_aux(r1, r2, kind, pool, depth + 1, found);
+		}
+		if(tl) tl->parent = nullptr;
+		if(tr) tr->parent = nullptr;
+		return k ? join3(tl, k, tr) : join2(tl, tr);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::set_operation(Bst& other, set_kind kind, thread_pool* pool){
+		static_assert(std::is_base_of<avl_balanced, balance_policy>::value, "the set operations need an avl_balanced tree");
+		if(&other == this){
+			if(kind == set_difference)
+				clear();
 			return;
+		}
+		size_t n_other = other.n_nodes;
+		bool copied;
+		node_type* b = take_nodes(other, copied);
+		std::atomic<size_t> found{0};
+		root = set_aux(root, b, kind, concurrent_alloc ? pool : nullptr, 0, found);
+		if(root) root->parent = nullptr;
+		if(kind == set_union)
+			n_nodes += n_other - found;
+		else if(kind == set_intersection)
+			n_nodes = found;
+		else
+			n_nodes -= found;
+		thread_tree();
+}
 
-		std::vector<pair_type> v_balance; 	
-		auto it = cbegin();
-		while(it != cend()){			//else form a vector of the pair of keys and 
-			v_balance.push_back(*it);	//values by doing an inorder walk of the tree
-			++it;
+/*
+****** PARALLEL BUILD ******
+* Used as tree.build_parallel(first, last, threads) and tree.build_parallel(first, last, threads, merge_fn).
+* 1. the pairs are copied, cut into one run per thread, the runs are sorted (stably) by tasks
+*    and merged pairwise, in log2(threads) rounds;
+* 2. the sorted array is cut again at key boundaries; for each run a task merges the repeated keys 
+*    into the first pair of their group and counts the keys left, which gives where its nodes go;
+* 3. a task per run creates its nodes (the allocation is serial unless the allocator is std::allocator);
+* 4. the subtrees of the middle nodes a few levels below the root are linked by tasks, then the levels 
+*    above them; with threaded the in-order links are set per run.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::link_range(node_type* const* nodes, size_t lo, size_t hi, int cut, task_group* spawn){
+		if(lo == hi)
+			return nullptr;
+		size_t mid = lo + (hi - lo)/2;
+		node_type* x = nodes[mid];
+		if(cut == 0){
+			if(spawn)
+				spawn->run([this, nodes, lo, hi]{ link_range(nodes, lo, hi, -1, nullptr); });
+			return x;
 		}
+		node_type* left = link_range(nodes, lo, mid, cut - 1, spawn);
+		node_type* right = link_range(nodes, mid + 1, hi, cut - 1, spawn);
+		if(spawn)
+			return x;						//linked on the second pass, after the tasks
+		x->left = left;
+		x->right = right;
+		if(left) left->parent = x;
+		if(right) right->parent = x;
+		pull(x);
+		return x;
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class It, class Merge>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::build_parallel(It first, It last, size_t threads, Merge merge_fn){
 		clear();
-		balance_aux(v_balance, v_balance.size());	//Give the vector to the auxillary function
+		using elem_type = std::pair<key_type, value_type>;
+		std::vector<elem_type> v(first, last);
+		size_t n = v.size();
+		size_t k = std::max<size_t>(1, std::min(threads, n / 1024 + 1));		//runs, not smaller than 1024 pairs
+		thread_pool pool{k - 1};												//the calling thread is the k-th worker
+		auto by_key = [this](const elem_type& a, const elem_type& b){ return compare(a.first, b.first); };
+
+		std::vector<size_t> bounds(k + 1);
+		for(size_t r = 0; r <= k; r++)
+			bounds[r] = n * r / k;
+		{
+			task_group group{pool};
+			for(size_t r = 0; r < k; r++)
+				group.run([&, r]{ std::stable_sort(v.begin() + bounds[r], v.begin() + bounds[r+1], by_key); });
+			group.wait();
+		}
+		for(size_t w = 1; w < k; w *= 2){									//merge the runs two by two
+			task_group group{pool};
+			for(size_t r = 0; r + w < k; r += 2*w)
+				group.run([&, r, w]{ 
+					std::inplace_merge(v.begin() + bounds[r], v.begin() + bounds[r+w], v.begin() + bounds[std::min(r + 2*w, k)], by_key); 
+				});
+			group.wait();
+		}
+
+		for(size_t r = 1; r < k; r++){											//a key must not span two runs
+			bounds[r] = std::max(bounds[r], bounds[r-1]);
+			while(bounds[r] > 0 && bounds[r] < n && !compare(v[bounds[r]-1].first, v[bounds[r]].first))
+				++bounds[r];
+		}
+		std::vector<size_t> offset(k + 1, 0);									//offset[r] = keys before the run r
+		std::vector<char> first_of_key(n, 0);
+		{
+			task_group group{pool};
+			for(size_t r = 0; r < k; r++)
+				group.run([&, r]{
+					size_t keys = 0;
+					for(size_t i = bounds[r], g = i; i < bounds[r+1]; i++){
+						if(i == g || compare(v[g].first, v[i].first)){		//a new key: its group starts here
+							g = i;
+							first_of_key[i] = 1;
+							++keys;
+						}else
+							merge_fn(v[g].second, v[i].second);
+					}
+					offset[r+1] = keys;
+				});
+			group.wait();
+		}
+		for(size_t r = 0; r < k; r++)
+			offset[r+1] += offset[r];
+		size_t m = offset[k];
+
+		std::vector<node_type*> nodes(m, nullptr);
+		auto create_run = [&](size_t r){
+			size_t j = offset[r];
+			for(size_t i = bounds[r]; i < bounds[r+1]; i++)
+				if(first_of_key[i])
+					nodes[j++] = create_node(std::move(v[i]));
+		};
+		try{
+			if(concurrent_alloc){
+				task_group group{pool};
+				for(size_t r = 0; r < k; r++)
+					group.run([&, r]{ create_run(r); });
+				group.wait();
+			}else{
+				for(size_t r = 0; r < k; r++)
+					create_run(r);
+			}
+		}catch(...){
+			for(node_type* x : nodes)
+				if(x) destroy_node(x);
+			throw;
+		}
+
+		int cut = 0;																//about 4 subtrees per thread
+		while((size_t(1) << cut) < 4*k && (size_t(1) << cut) < m)
+			++cut;
+		{
+			task_group group{pool};
+			link_range(nodes.data(), 0, m, cut, &group);
+			if(linked)
+				for(size_t r = 0; r < k; r++)
+					group.run([&, r]{
+						for(size_t i = offset[r]; i < offset[r+1]; i++)
+							nodes[i]->set_links(i ? nodes[i-1] : nullptr, i + 1 < m ? nodes[i+1] : nullptr);
+					});
+			group.wait();
+		}
+		root = link_range(nodes.data(), 0, m, cut, nullptr);
+		if(root) root->parent = nullptr;
+		n_nodes = m;
+}
+
+/*
+****** BATCH INSERT ******
+* Used as tree.insert_batch(batch) and tree.upsert_batch(batch, merge_fn).
+* The batch is sorted by key (stably, so repeated keys are applied in the order of the batch), then:
+* - if it is large compared to the tree (at least half of its size), the tree is flattened into a vine,
+*   merged with the batch in one pass and relinked into a balanced tree, in O(n + m);
+* - otherwise the keys are inserted in order starting from the previously inserted node: 
+*   the successor of that node bounds the gap in which the next key may fall, and when it does
+*   the key is attached without walking from the root again.
+* Only the pairs whose key is new are allocated.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class Range, class Merge>
+	std::vector<bool> Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::batch_aux(const Range& batch, Merge merge_fn, bool upsert){
+		using elem_type = typename std::decay<decltype(*std::begin(batch))>::type;
+		std::vector<const elem_type*> elems;
+		for(const auto& e : batch)
+			elems.push_back(&e);
+		size_t m = elems.size();
+		std::vector<size_t> order(m);
+		for(size_t i = 0; i < m; i++)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){ return compare(elems[a]->first, elems[b]->first); });
+		std::vector<bool> inserted(m, false);
+
+		if(2 * m >= n_nodes){
+			//Merge the vine of the tree with the sorted batch into a new vine
+			node_type* old_head;
+			tree_to_vine(old_head);
+			node_type* head = nullptr;
+			node_type* tail = nullptr;
+			size_t n = 0;
+			auto append = [&](node_type* x){
+				if(tail) tail->right = x;
+				else head = x;
+				tail = x;
+				++n;
+			};
+			try{
+				for(size_t i = 0; i < m; i++){
+					const elem_type& e = *elems[order[i]];
+					while(old_head && compare(old_head->value.first, e.first)){	//old nodes before the key
+						node_type* next = old_head->right;
+						append(old_head);
+						old_head = next;
+					}
+					if(tail && !compare(tail->value.first, e.first)){			//repeated key in the batch
+						if(upsert) merge_fn(tail->value.second, e.second);
+						continue;
+					}
+					if(old_head && !compare(e.first, old_head->value.first)){	//the key is in the tree
+						if(upsert) merge_fn(old_head->value.second, e.second);
+						node_type* next = old_head->right;
+						append(old_head);
+						old_head = next;
+						continue;
+					}
+					node_type* x = create_node(e);
+					inserted[order[i]] = true;
+					append(x);
+				}
+			}catch(...){
+				while(old_head){								//keep what was merged so far
+					node_type* next = old_head->right;
+					append(old_head);
+					old_head = next;
+				}
+				if(tail) tail->right = nullptr;
+				thread_vine(head);
+				root = vine_to_tree(head, n);
+				if(root) root->parent = nullptr;
+				n_nodes = n;
+				throw;
+			}
+			while(old_head){
+				node_type* next = old_head->right;
+				append(old_head);
+				old_head = next;
+			}
+			if(tail) tail->right = nullptr;
+			thread_vine(head);
+			root = vine_to_tree(head, n);
+			if(root) root->parent = nullptr;
+			n_nodes = n;
+			return inserted;
+		}
+
+		node_type* last = nullptr;		//node of the previous key of the batch
+		node_type* bound = nullptr;		//its successor in the tree (nullptr if it is the maximum)
+		for(size_t i = 0; i < m; i++){
+			const elem_type& e = *elems[order[i]];
+			node_type* found = nullptr;
+			node_type* parent = nullptr;
+			node_type* gap_bound = nullptr;
+			int side = 0;
+			if(last && !compare(last->value.first, e.first)){
+				found = last;												//repeated key in the batch
+			}else if(last && (!bound || compare(e.first, bound->value.first))){
+				gap_bound = bound;											//the key falls right after last:
+				if(!last->right){											//attach it as the right child of last
+					parent = last;
+					side = 1;
+				}else{														//or as the left child of its successor
+					parent = bound;
+					side = 0;
+				}
+			}else{
+				node_type* tmp = root;										//walk from the root, remembering
+				while(tmp){													//the last node where we turned left
+					if(compare(e.first, tmp->value.first)){
+						gap_bound = tmp;
+						if(!tmp->left){ parent = tmp; side = 0; break; }
+						tmp = tmp->left;
+					}else if(compare(tmp->value.first, e.first)){
+						if(!tmp->right){ parent = tmp; side = 1; break; }
+						tmp = tmp->right;
+					}else{
+						found = tmp;
+						break;
+					}
+				}
+			}
+			if(found){
+				if(upsert) merge_fn(found->value.second, e.second);
+				if(found != last){
+					bound = gap_bound;
+					if(found->right){										//the successor is in the right subtree
+						bound = found->right;
+						while(bound->left)
+							bound = bound->left;
+					}
+					last = found;
+				}
+				continue;
+			}
+			node_type* x = link_node(create_node(e), parent, side);
+			inserted[order[i]] = true;
+			last = x;
+			bound = (side == 0) ? parent : gap_bound;	//rotations don't change the order, so it stays valid
+		}
+		return inserted;
 }
 
 /*
@@ -398,28 +2196,31 @@ template <typename key_type, typename value_type, typename comp_op>
 //It transplants one node with another node, the parent and the children
 //of the first node are set to the second node. 
 //It is typically used when a node with two children has to erased.
-template <typename key_type, typename value_type, typename comp_op>
-	void Bst<key_type, value_type, comp_op>::swap_node(node_type* x, node_type* y){
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::swap_node(node_type* x, node_type* y){
 	int chSide_x = childhoodSide(x);	//determine the childhood side of the nodes x and y
 	int chSide_y = childhoodSide(y);
 
 	release_child(y->parent, chSide_y);	//Relase the node y from its parent node
             
 	if(y->right && y->parent != x){		
-        node_type* y_rightChild = y->right.release();	//If y has a right child and y is not a child of x
+        node_type* y_rightChild = y->right;				//If y has a right child and y is not a child of x
+        y->right = nullptr;
         reset_child(y->parent, y_rightChild, chSide_y); //Set the right child of y as the child of y's parent 
         y_rightChild->parent = y->parent;				//on the childhood side of y.
     }													// Make y's parent as the parent of y's right child.
                  
-    y->left.release();									//By logic, y should not have a left child.
+    y->left = nullptr;									//By logic, y should not have a left child.
     if(x->left){										
-        node_type* x_leftChild = x->left.release();	    //For the left child of x, set it as the left child of y
-        y->left.reset(x_leftChild);						
+        node_type* x_leftChild = x->left;			    //For the left child of x, set it as the left child of y
+        x->left = nullptr;
+        y->left = x_leftChild;
 		x_leftChild->parent = y;						//Set y as the parent of x's right child
     }
-    if(x->right && x->right.get() != y){				//For the right child of x do the same only if y is not 
-        node_type* x_rightChild = x->right.release();	//the right child of x
-        y->right.reset(x_rightChild);
+    if(x->right && x->right != y){						//For the right child of x do the same only if y is not 
+        node_type* x_rightChild = x->right;				//the right child of x
+        x->right = nullptr;
+        y->right = x_rightChild;
 		x_rightChild->parent = y;
     }
                  
@@ -428,10 +2229,283 @@ template <typename key_type, typename value_type, typename comp_op>
 		reset_child(x->parent, y, chSide_x);
         y->parent = x->parent;							//If x is not the root, set y's parent as x's parent 
 	}else{
-		root.release();									//If x is the root, reset the root to y
-		root.reset(y);									// and set y's parent to nullptr
+		root = y;										//If x is the root, reset the root to y
+														// and set y's parent to nullptr
 		y->parent = nullptr;
 	}
+	y->height = x->height;
+	y->set(x->get());
+}
+
+/*
+******** ROTATIONS *********
+* Used by the balancing policies to restructure the tree.
+* rotate_left(x) makes the right child y of x the root of the subtree and x the left child of y,
+* the left subtree of y becomes the right subtree of x. rotate_right(x) is its mirror image.
+* Only links are changed, so no node is reallocated and iterators stay valid.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::rotate_left(node_type* x) noexcept{
+		node_type* p = x->parent;
+		int chSide_x = childhoodSide(x);
+		node_type* y = x->right;
+		node_type* y_left = y->left;
+		x->right = y_left;							//the left subtree of y moves under x
+		if(y_left) y_left->parent = x;
+		y->left = x;								//x becomes the left child of y
+		x->parent = y;
+		if(p) reset_child(p, y, chSide_x);			//and y takes the place of x
+		else root = y;
+		y->parent = p;
+		pull(x);
+		pull(y);
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::rotate_right(node_type* x) noexcept{
+		node_type* p = x->parent;
+		int chSide_x = childhoodSide(x);
+		node_type* y = x->left;
+		node_type* y_right = y->right;
+		x->left = y_right;
+		if(y_right) y_right->parent = x;
+		y->right = x;
+		x->parent = y;
+		if(p) reset_child(p, y, chSide_x);
+		else root = y;
+		y->parent = p;
+		pull(x);
+		pull(y);
+}
+
+/*
+******** BOUNDS *********
+* The bound is the last node where the descent turned left: every key visited after it
+* is smaller than it, and it is the smallest key not less (greater) than x.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+template <class K>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::lower_node(const K& x) const{
+		node_type* bound = nullptr;
+		node_type* tmp = root;
+		while(tmp){
+			if(compare(tmp->value.first, x)){
+				tmp = tmp->right;
+			}else{
+				bound = tmp;
+				tmp = tmp->left;
+			}
+		}
+		return bound;
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+template <class K>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::upper_node(const K& x) const{
+		node_type* bound = nullptr;
+		node_type* tmp = root;
+		while(tmp){
+			if(compare(x, tmp->value.first)){
+				bound = tmp;
+				tmp = tmp->left;
+			}else{
+				tmp = tmp->right;
+			}
+		}
+		return bound;
+}
+
+/*
+******** PARALLEL TRAVERSAL *********
+* The tree is cut at subtree boundaries: the subtrees rooted parallel_depth levels below the root
+* are traversed by the tasks of a work-stealing pool, the few nodes above them by the calling thread.
+* The cut only depends on the shape of the tree, so do the pieces combined by parallel_reduce.
+* A degenerate tree has most of its nodes in one subtree, and gets little parallelism.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class F>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::for_each_node(node_type* x, F f){
+		node_type* top = x;
+		node_type* from = x ? x->parent : nullptr;
+		while(x){
+			node_type* next = nullptr;
+			if(from == x->parent && x->left){			//first visit: the left subtree first
+				next = x->left;
+			}else if(!x->right || from != x->right){	//left subtree done: the node, then the right subtree
+				f(x);
+				next = x->right;
+			}
+			if(next){
+				from = x;
+				x = next;
+			}else{
+				from = x;
+				x = (x == top) ? nullptr : x->parent;
+			}
+		}
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class Prepare, class F>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::parallel_aux(thread_pool& pool, Prepare prepare, F f) const{
+		std::vector<std::pair<node_type*, bool>> pieces;		//(node, whole subtree)
+		std::vector<std::pair<node_type*, int>> stack;
+		if(root && n_nodes < parallel_grain)
+			pieces.push_back({root, true});
+		else if(root)
+			stack.push_back({root, 0});
+		while(!stack.empty()){							//in-order walk of the levels above the cut
+			node_type* x = stack.back().first;
+			int depth = stack.back().second;			//negative when back from the left subtree
+			stack.pop_back();
+			if(depth < 0){
+				pieces.push_back({x, false});
+				if(x->right) stack.push_back({x->right, -depth});
+			}else if(depth == parallel_depth){
+				pieces.push_back({x, true});
+			}else{
+				stack.push_back({x, -(depth + 1)});
+				if(x->left) stack.push_back({x->left, depth + 1});
+			}
+		}
+		prepare(pieces.size());
+		if(pieces.size() == 1){							//a small tree is not worth the tasks
+			for_each_node(root, [&](node_type* x){ f(0, x); });
+			return;
+		}
+		task_group group{pool};
+		for(size_t i = 0; i < pieces.size(); i++)
+			if(pieces[i].second)
+				group.run([&f, &pieces, i]{ for_each_node(pieces[i].first, [&](node_type* x){ f(i, x); }); });
+		for(size_t i = 0; i < pieces.size(); i++)
+			if(!pieces[i].second)
+				f(i, pieces[i].first);
+		group.wait();
+}
+
+//The partial result of each piece starts from the map of its first pair, so that init is used once
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	template <class T, class Map, class Combine>
+	T Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::parallel_reduce(T init, Map map, Combine combine, thread_pool& pool) const{
+		std::vector<std::unique_ptr<T>> partial;
+		parallel_aux(pool, [&](size_t n){ partial.resize(n); }, [&](size_t i, node_type* x){
+			const pair_type& v = x->value;
+			if(partial[i])
+				*partial[i] = combine(std::move(*partial[i]), map(v));
+			else
+				partial[i].reset(new T(map(v)));
+		});
+		for(auto& p : partial)
+			if(p)
+				init = combine(std::move(init), std::move(*p));
+		return init;
+}
+
+/*
+******** ORDER STATISTICS *********
+* rank and select descend from the root once, using the size of the left subtrees:
+* going right skips the left subtree and the node itself.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+template <class K>
+	size_t Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::rank_aux(const K& x) const{
+		static_assert(counted, "rank needs the order_statistics policy");
+		size_t r = 0;
+		node_type* tmp = root;
+		while(tmp){
+			if(compare(tmp->value.first, x)){
+				r += node_size(tmp->left) + 1;
+				tmp = tmp->right;
+			}else
+				tmp = tmp->left;
+		}
+		return r;
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::select_node(size_t k) const noexcept{
+		static_assert(counted, "select needs the order_statistics policy");
+		node_type* tmp = root;
+		while(tmp){
+			size_t l = node_size(tmp->left);
+			if(k < l){
+				tmp = tmp->left;
+			}else if(k > l){
+				k -= l + 1;
+				tmp = tmp->right;
+			}else
+				return tmp;
+		}
+		return nullptr;
+}
+
+/*
+******** SPLAY *********
+* Bottom-up semi-splaying, two levels at a time. When x and its parent are children on the
+* same side (zig-zig) only the grandparent is rotated, bringing the parent up, and the splay goes
+* on from the parent; otherwise (zig-zag) x is rotated up twice. A last single rotation (zig) is 
+* done when the parent is the root. Either way the depth of the nodes on the path is roughly 
+* halved, with half the rotations of a full splay (whose zig-zig also rotates x over its parent).
+* Every node rotated is pulled, and every ancestor of x is rotated, so the heights and sizes of 
+* the path are up to date at the end.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::splay(node_type* x) noexcept{
+		while(x->parent){
+			node_type* p = x->parent;
+			node_type* g = p->parent;
+			bool left = (p->left == x);
+			if(!g){													//zig
+				if(left) rotate_right(p);
+				else rotate_left(p);
+			}else if(left == (g->left == p)){						//zig-zig: the parent goes up in place of
+				if(left) rotate_right(g);							//the grandparent and the splay goes on from it
+				else rotate_left(g);
+				x = p;
+			}else{													//zig-zag
+				if(left){
+					rotate_right(p);
+					rotate_left(g);
+				}else{
+					rotate_left(p);
+					rotate_right(g);
+				}
+			}
+		}
+}
+
+/*
+******** AVL REBALANCE *********
+* Walks from x up to the root recomputing the heights. Whenever the heights of the two
+* subtrees of a node differ by more than one, a single or double rotation restores the
+* AVL property, so that the height of the whole tree stays below 1.44 log2(n+2).
+* Once a subtree is back to the height it had, nothing above it changes and the walk stops
+* (unless the sizes are kept, they change up to the root): an insert next to the previous
+* one, as with increasing keys, retraces O(1) nodes amortized.
+*/
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::rebalance(node_type* x, avl_balanced) noexcept{
+		while(x){
+			int old_height = x->height;
+			pull(x);
+			int factor = node_height(x->left) - node_height(x->right);
+			if(factor > 1){											//left heavy
+				node_type* l = x->left;
+				if(node_height(l->left) < node_height(l->right))
+					rotate_left(l);									//left-right case
+				rotate_right(x);
+				x = x->parent;										//the new root of the subtree
+			}else if(factor < -1){									//right heavy
+				node_type* r = x->right;
+				if(node_height(r->right) < node_height(r->left))
+					rotate_right(r);								//right-left case
+				rotate_left(x);
+				x = x->parent;
+			}
+			if(!counted && x->height == old_height)
+				return;
+			x = x->parent;
+		}
 }
 
 /*
@@ -439,79 +2513,145 @@ template <typename key_type, typename value_type, typename comp_op>
 * The erase function takes in a key as its argument and deletes the node 
 * containing the key fromt he tree.
 * used as tree.erase(key)
+* detach_node takes the node out of the tree, erase then frees it and extract hands it over.
 */
-template <typename key_type, typename value_type, typename comp_op>
-	void Bst<key_type, value_type, comp_op>::erase(const key_type& x){
-		auto it = find(x);								//Find the key
-		if (it != end()){								
-			node_type* a = it.getCurrent();
-			if(!a->left && !a->right){					//If the key is found, check for the children
-				int chSide = childhoodSide(a);			//of the corresponding node.
-				release_child(a->parent,chSide);		//IF the node is a leaf, release it from
-				delete a;								//its parent and delete the node.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+template <class K>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::erase_aux(const K& x){
+		op_scope<bst_stats> scope{counters, op_kind::erase};
+		node_type* a = find_node(x);					//Find the key
+		if(a){
+			detach_node(a);
+			delete_node(a);							// Don't forget to delete the node everytime once the job is done ;)
+		}
+		else{										//If we try to erase a key which is not in the tree
+			std::cout << "The given key doesn't exist" << std::endl;
+		}
+}
+
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::detach_node(node_type* a) noexcept{
+		node_type* a_parent = a->parent;
+		--n_nodes;			//The path from here up is where the policy rebalances
+		a->unlink();		//(with threaded) its neighbours in the order now follow each other
+		unmark(a);
+		if(!a->left && !a->right){					//If the key is found, check for the children
+			int chSide = childhoodSide(a);			//of the corresponding node.
+			if(!a_parent){							//IF the node is a leaf, release it from
+				root = nullptr;						//its parent (a leaf root is simply the last node of the tree)
 				return;
 			}
-			int chSide_a = childhoodSide(a);			//If the node is not a leaf, see its childhood side
-			if(!a->left){
-				node_type* a_right = a->right.release();	//If the node lacks a left child, replace the node
-				if(a == root.get()){						// with its left child
-					root.release();							//If its the root & it lacks the left child
-					root.reset(a_right);					//reset the root with the right child
-					a_right->parent = nullptr;				// Set the right child parent to nullptr.
-					delete_node(a);							
-					return;
-				}
-				release_child(a->parent, chSide_a);			
-				reset_child(a->parent, a_right, chSide_a);	
-				a_right->parent = a->parent;				
-				delete_node(a);
+			release_child(a_parent,chSide);
+			rebalance(a_parent);
+			return;
+		}
+		int chSide_a = childhoodSide(a);			//If the node is not a leaf, see its childhood side
+		if(!a->left){
+			node_type* a_right = a->right;				//If the node lacks a left child, replace the node
+			if(a == root){								// with its left child
+				root = a_right;							//If its the root & it lacks the left child
+														//reset the root with the right child
+				a_right->parent = nullptr;				// Set the right child parent to nullptr.
 				return;
 			}
-			if(!a->right){
-				node_type* a_left = a->left.release();	// If node lacks a right child, do similarly as when it 
-				if(a == root.get()){					// a left child; replace the node with its left child
-					root.release();
-					root.reset(a_left);
-					a_left->parent = nullptr;
-					delete_node(a);
-					return;
-				}
-				release_child(a->parent, chSide_a);
-				reset_child(a->parent, a_left, chSide_a);
-				a_left->parent = a->parent;
-				delete_node(a);
+			release_child(a->parent, chSide_a);			
+			reset_child(a->parent, a_right, chSide_a);	
+			a_right->parent = a->parent;				
+			rebalance(a_parent);
+			return;
+		}
+		if(!a->right){
+			node_type* a_left = a->left;			// If node lacks a right child, do similarly as when it 
+			if(a == root){							// a left child; replace the node with its left child
+				root = a_left;
+				a_left->parent = nullptr;
 				return;
 			}
-			++it;									//If the node has both the children, 
-			node_type* b = it.getCurrent();			//go to the successor of the node
-			swap_node(a,b);							//replace the node with its successor
-			delete_node(a);							// Don't forget to delete the node everytime once the job is done ;)
-		}
-		else{										//If we try to erase a key which is not in the tree
-			std::cout << "The given key doesn't exist" << std::endl;
+			release_child(a->parent, chSide_a);
+			reset_child(a->parent, a_left, chSide_a);
+			a_left->parent = a->parent;
+			rebalance(a_parent);
+			return;
 		}
+		node_type* b = iterator::successor(a);	//If the node has both the children, go to the successor of the node
+		node_type* b_parent = (b->parent == a) ? b : b->parent;	//the lowest node whose subtree changes
+		swap_node(a,b);							//replace the node with its successor
+		rebalance(b_parent);
+		mark(b);								//(if the retrace stopped below b its children have their heights)
 }
 
-// A simple breadth first traversal of the tree
-template <typename key_type, typename value_type, typename comp_op>
-	void Bst<key_type, value_type, comp_op>::bfs_aux(node_type* x, size_t level){
-		if (!x)
-			return;
-		if(level == 1){
-			pair_type val = x->value;
-			std::cout << val.second << " ";
+/*
+******* 5. CLEAR AND COPY *******
+*destroy_subtree gives back to the allocator every node of a subtree, 
+*clone copies a subtree node by node in the allocator of this tree.
+*Both work in constant stack space, whatever the height of the tree.
+*/
+//Right rotations bring the left children up until the current node has none,
+//then the node is freed and the walk goes on with its right child.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::destroy_subtree(node_type* x) noexcept{
+		while(x){
+			if(x->left){
+				node_type* l = x->left;				//rotate right at x
+				x->left = l->right;
+				l->right = x;
+				x = l;
+			}else{
+				node_type* next = x->right;
+				destroy_node(x);
+				x = next;
+			}
 		}
-		else{
-			bfs_aux(x->left.get(), level-1 );
-			bfs_aux(x->right.get(), level-1 );
+}
+
+//The source is walked in pre-order through the parent pointers, and the copy alongside it:
+//a child is copied the first time its parent is reached without the corresponding copy.
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	typename Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::node_type* Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::clone(node_type* x, node_type* p){
+		if(!x)
+			return nullptr;
+		node_type* y = create_node(x->value, p);
+		copy_kept(y, x);
+		node_type* src = x;
+		node_type* dst = y;
+		try{
+			while(true){
+				if(src->left && !dst->left){
+					dst->left = create_node(src->left->value, dst);
+					copy_kept(dst->left, src->left);
+					src = src->left;
+					dst = dst->left;
+				}else if(src->right && !dst->right){
+					dst->right = create_node(src->right->value, dst);
+					copy_kept(dst->right, src->right);
+					src = src->right;
+					dst = dst->right;
+				}else if(src == x){
+					break;
+				}else{
+					src = src->parent;
+					dst = dst->parent;
+				}
+			}
+		}catch(...){
+			destroy_subtree(y);				//don't leak the part already copied
+			throw;
 		}
-	}
+		return y;
+}
 
-template <typename key_type, typename value_type, typename comp_op>
-	void Bst<key_type, value_type, comp_op>::bfs(){
-		size_t h = height(root.get());
-		for(size_t i = 1; i <= h; i++)
-			bfs_aux(root.get(), i);
+// A simple breadth first traversal of the tree, the nodes of each level are queued in order
+template <typename key_type, typename value_type, typename comp_op, typename balance_policy, typename alloc_type>
+	void Bst<key_type, value_type, comp_op, balance_policy, alloc_type>::bfs(){
+		std::vector<node_type*> queue;
+		if(root)
+			queue.push_back(root);
+		for(size_t i = 0; i < queue.size(); i++){
+			node_type* x = queue[i];
+			std::cout << x->value.second << " ";
+			if(x->left) queue.push_back(x->left);
+			if(x->right) queue.push_back(x->right);
+		}
 		std::cout << std::endl;
 	}
 
@@ -0,0 +1,170 @@
+#ifndef __frozen_bst_hpp
+#define __frozen_bst_hpp
+
+#include <iostream>
+#include <utility>
+#include <memory>
+#include <algorithm>
+#include <vector>
+
+#include "bst.hpp"
+
+/*
+*************** Class FROZEN BINARY SEARCH TREE ****************
+*A read-only snapshot of a Bst for lookup heavy workloads.
+*The keys are stored in a single array in Eytzinger (breadth first) order:
+*the root is at position 1 and the children of the node at position k are at 2k and 2k+1,
+*so the search needs no pointers and walks the array always in the same direction.
+*The values live in a parallel array, so that the search touches only the keys.
+*
+*The search is branchless: at each level the result of the comparison is added to the
+*index (k = 2k + compare(key_k, x)). The descendants of a node a few levels below are
+*contiguous and share a cache line, which is prefetched while the upper levels are compared,
+*so that the cache misses of consecutive levels overlap.
+*It supports the following operations
+*1. FIND --> Locate a key
+*2. LOWER_BOUND --> First key not less (as per the comparison operator) than a given key
+*3. In order iteration with begin()/end()
+*/
+template <typename key_type, typename value_type, typename comp_op = std::less<key_type>>
+	class FrozenBst{
+		std::vector<key_type> keys;		//the keys in Eytzinger order, keys[k-1] holds the node k
+		std::vector<value_type> values;	//values[k-1] is associated with keys[k-1]
+		comp_op compare;
+		size_t n;
+
+		//number of keys in a cache line: the descendants of k at log2(block) levels below start at block*k
+		static constexpr size_t block = sizeof(key_type) < 64 ? 64/sizeof(key_type) : 1;
+
+		//Position of the first key not less than x, 0 if there is none
+		template <class K>
+		size_t search(const K& x) const noexcept{
+			size_t k = 1;
+			const key_type* base = keys.data();
+			while(k <= n){
+#if defined(__GNUC__)
+				if(block*k <= n)
+					__builtin_prefetch(base + block*k - 1);		//the descendants of k log2(block) levels below
+#endif
+				k = 2*k + compare(base[k-1], x);				//go right if key_k < x, left otherwise
+			}
+			return k >> __builtin_ffsll(~k);					//undo the last right steps and one left step
+		}
+
+		//Fill the position k and its subtree with the sorted pairs from the index i on (in order)
+		void layout(std::vector<size_t>& order, size_t k, size_t& i) noexcept{
+			if(k > n)
+				return;
+			layout(order, 2*k, i);
+			order[k-1] = i++;
+			layout(order, 2*k+1, i);
+		}
+
+		//The keys and values are copied once in order, then moved to their place in the layout:
+		//any range of pairs works, whatever the const-ness of its keys
+		template <class It>
+		void build(It first, It last){
+			std::vector<key_type> sorted_keys;
+			std::vector<value_type> sorted_values;
+			for(; first != last; ++first){
+				sorted_keys.push_back((*first).first);
+				sorted_values.push_back((*first).second);
+			}
+			n = sorted_keys.size();
+			std::vector<size_t> order(n);				//order[k-1] is the rank of the key placed at k
+			size_t i = 0;
+			layout(order, 1, i);
+			keys.reserve(n);
+			values.reserve(n);
+			for(size_t k = 0; k < n; k++){
+				keys.push_back(std::move(sorted_keys[order[k]]));
+				values.push_back(std::move(sorted_values[order[k]]));
+			}
+		}
+
+		public:
+			//Iterator visiting the keys in order. The successor of k is the leftmost node of its
+			//right subtree, or, if k has no right child, the parent of the last left step above k.
+			class const_iterator{
+				const FrozenBst* tree;
+				size_t k;
+
+				public:
+					const_iterator(const FrozenBst* t, size_t x) noexcept: tree{t}, k{x} {}
+
+					friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.k == b.k; }
+					friend bool operator!=(const const_iterator& a, const const_iterator& b) { return !(a == b); }
+
+					using val_type = std::pair<const key_type&, const value_type&>;
+					using difference_type = std::ptrdiff_t;
+					using iterator_category = std::forward_iterator_tag;
+					using reference = val_type;
+
+					struct pointer{
+						val_type p;
+						const val_type* operator->() const noexcept { return &p; }
+					};
+
+					reference operator*() const noexcept { return val_type(tree->keys[k-1], tree->values[k-1]); }
+					pointer operator->() const noexcept { return pointer{*(*this)}; }
+
+					const_iterator& operator++() noexcept{
+						if(2*k+1 <= tree->n){				//leftmost node of the right subtree
+							k = 2*k+1;
+							while(2*k <= tree->n)
+								k = 2*k;
+						}else
+							k >>= __builtin_ffsll(~k);		//climb the right steps and one left step
+						return *this;
+					}
+					const_iterator operator++(int) noexcept{
+						const_iterator tmp{*this};
+						++(*this);
+						return tmp;
+					}
+			};
+			using iterator = const_iterator;
+
+			FrozenBst(): compare{comp_op()}, n{0} {}
+			//Build from a range of pairs already sorted as per comp
+			template <class It>
+			FrozenBst(It first, It last, comp_op comp = comp_op()): compare{comp}, n{0} { build(first, last); }
+			//Freeze the current content of a Bst
+			template <typename balance_policy, typename alloc_type>
+			explicit FrozenBst(const Bst<key_type, value_type, comp_op, balance_policy, alloc_type>& tree, comp_op comp = comp_op()): compare{comp}, n{0} {
+				build(tree.cbegin(), tree.cend());
+			}
+
+			size_t size() const noexcept { return n; }
+			bool empty() const noexcept { return n == 0; }
+
+			const_iterator begin() const noexcept{
+				size_t k = n ? 1 : 0;
+				while(k && 2*k <= n)
+					k = 2*k;
+				return const_iterator(this, k);
+			}
+			const_iterator end() const noexcept { return const_iterator(this, 0); }
+			const_iterator cbegin() const noexcept { return begin(); }
+			const_iterator cend() const noexcept { return end(); }
+
+			//First key not less than x, end() if there is none ==> frozen.lower_bound(key)
+			const_iterator lower_bound(const key_type& x) const noexcept { return const_iterator(this, search(x)); }
+
+			//Locate a key ==> frozen.find(key), end() if it is not there
+			const_iterator find(const key_type& x) const noexcept{
+				size_t k = search(x);
+				if(k && !compare(x, keys[k-1]))
+					return const_iterator(this, k);
+				return end();
+			}
+
+			//on printing the tree, the tree follows inorder traversal.
+			friend std::ostream& operator<<(std::ostream& os, const FrozenBst& tree){
+				for(auto it = tree.cbegin(); it != tree.cend(); ++it)
+					os << (*it).second << " ";
+				return os;
+			}
+};
+
+#endif
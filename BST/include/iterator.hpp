@@ -7,28 +7,61 @@
 #include <algorithm>
 #include <vector>
 #include <cmath>
+#include <type_traits>
 
 #include "bst.hpp"
 
 /*
 ************* Class Iterator for the BST *****************
-A forward iterator has been used for our container
+A bidirectional iterator has been used for our container.
+The end of the tree is the null node, so the iterator also keeps the address of the root
+of its tree, from where --end() finds the last node.
+That address belongs to the Bst object, not to the nodes: a move of the tree (construction,
+or assignment taking over the nodes) keeps the iterators to its nodes valid, but end() and any
+iterator stepped past the last node still refer to the moved-from object and must not be
+decremented once it is gone. Take end() again from the tree the nodes were moved into.
+With the threaded policy the nodes are linked in order (next/prev) and every step is O(1);
+otherwise the steps climb through the parent pointers, O(1) amortized.
 */
 template <typename node_type, typename O>
     class __iterator{
 		node_type* current;
+		node_type* const* root;						//the root of the tree of the node
+
+		//Successor/predecessor through the in-order links
+		void step_forward(std::true_type) noexcept { current = current->next; }
+		void step_backward(std::true_type) noexcept { current = current->prev; }
+		//Successor/predecessor through the parent pointers
+		void step_forward(std::false_type) noexcept { current = successor(current); }
+		void step_backward(std::false_type) noexcept{
+			if(current->left){							//rightmost node of the left branch
+				current = current->left;
+				while(current->right)
+					current = current->right;
+			}else{										//or the first ancestor of which the node is in the right branch
+				while(current->parent && current->parent->left == current)
+					current = current->parent;
+				current = current->parent;
+			}
+		}
+		using threaded = std::integral_constant<bool, node_type::linked>;
 
 		public:
-			explicit __iterator(node_type* x) noexcept: current{x} {}
+			__iterator(node_type* x, node_type* const* r) noexcept: current{x}, root{r} {}
+			//a const_iterator can be made from an iterator
+			template <typename P, class = typename std::enable_if<std::is_convertible<P*, O*>::value>::type>
+			__iterator(const __iterator<node_type, P>& it) noexcept: current{it.getCurrent()}, root{it.getRoot()} {}
 
 			node_type* getCurrent() const { return current; }
+			node_type* const* getRoot() const { return root; }
 
 			friend bool operator==(const __iterator&a, const __iterator&b) { return a.current == b.current; } //equality of the nodes
 			friend bool operator!=(const __iterator&a, const __iterator&b) { return !(a == b); }
 			
 			using val_type = O;
+			using value_type = typename std::remove_const<O>::type;
 			using difference_type = std::ptrdiff_t;
-			using iterator_category = std::forward_iterator_tag;
+			using iterator_category = std::bidirectional_iterator_tag;
 			using reference = val_type&;
 			using pointer = val_type*;
 
@@ -36,29 +69,44 @@ template <typename node_type, typename O>
 			pointer operator->() const noexcept { return &(*(*this)); }
 
 			//The inorder traversal of the tree is done by overloading the pre increment operator++
-			__iterator& operator++() noexcept{			
-				if(current->right){							//The sucessor of each node is found 
-					current = current->right.get();			//if the node has a right branch 
-					while(current->left)					//go to the leftmost node of the right branch
-						current = current->left.get();
-				}
-				else if(!current->parent){					//If node is the root, set current to nullptr
-					current = nullptr;
-				}else if(current->parent->left.get() == current){	//If the node is a left child
-					current = current->parent;						//then the succesor is the parent itself 
-				}else{												
-					while (current->parent && current->parent->right.get() == current)
-						current = current->parent;					//Else when the node is a right child, keep traversing
-					current = current->parent;						//until the node ceases to be a right child or
-				}													//becomes the root. The successor is the parent of									
-				return *this;										//of this node.
+			__iterator& operator++() noexcept{
+				step_forward(threaded{});
+				return *this;
 			}
-
-			__iterator& operator++(int) noexcept{
-				__iterator tmp{current};
+			__iterator operator++(int) noexcept{
+				__iterator tmp{*this};
 				++(*this);
 				return tmp;
 			}
+			//The end of the tree goes back to the last node
+			__iterator& operator--() noexcept{
+				if(!current){
+					current = *root;
+					while(current && current->right)
+						current = current->right;
+				}else
+					step_backward(threaded{});
+				return *this;
+			}
+			__iterator operator--(int) noexcept{
+				__iterator tmp{*this};
+				--(*this);
+				return tmp;
+			}
+
+			//The in-order successor of x (nullptr for the last node), found through the parent pointers
+			static node_type* successor(node_type* x) noexcept{
+				if(x->right){								//The sucessor of each node is found 
+					x = x->right;							//if the node has a right branch 
+					while(x->left)							//go to the leftmost node of the right branch
+						x = x->left;
+				}else{
+					while(x->parent && x->parent->right == x)
+						x = x->parent;						//Else when the node is a right child, keep traversing
+					x = x->parent;							//until the node ceases to be a right child or
+				}											//becomes the root. The successor is the parent of
+				return x;									//this node (nullptr past the root).
+			}
 };
 
-#endif
\ No newline at end of file
+#endif
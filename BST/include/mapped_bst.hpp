@@ -0,0 +1,509 @@
+#ifndef __mapped_bst_hpp
+#define __mapped_bst_hpp
+
+#include <iostream>
+#include <utility>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+*************** Class MEMORY MAPPED BINARY SEARCH TREE ****************
+*An AVL tree whose nodes live in a file mapped in memory (POSIX mmap), for trivially copyable
+*keys and values. The links between the nodes are offsets from the start of the file instead of
+*pointers, so the file means the same tree wherever it is mapped. Hence
+*1. REOPEN --> MappedBst<k,v> tree{"tree.map"} maps an existing file in O(1): nothing is read,
+*   the pages are faulted in by the first accesses to them.
+*2. SYNC --> tree.sync() is a durability point: every change made before it is on disk (msync).
+*   The tree is synced when it is destroyed as well.
+*The file starts with a header (root, size, end of the used space, list of the free nodes);
+*the erased nodes are reused by the next inserts and the file doubles when it is full.
+*A change marks the header dirty (synchronously) before touching any node and sync() marks it clean
+*after all the nodes are on disk: opened_clean() tells if the file was left by a sync, a file left
+*dirty by a crash may hold a half done change.
+*The iterators hold offsets as well: they stay valid when the file grows, until their node is erased.
+*The references they give (*it, it->second) and the ones of operator[] point into the mapping, which an
+*insert growing the file maps again elsewhere: only the offsets survive, the references dangle.
+*The comparator must order the keys as it did when the file was written.
+*/
+template <typename key_type, typename value_type, typename comp_op = std::less<key_type>>
+	class MappedBst{
+		static_assert(std::is_trivially_copyable<key_type>::value && std::is_trivially_copyable<value_type>::value,
+			"MappedBst needs trivially copyable keys and values");
+
+		public:
+			//The pairs stored in the file
+			struct entry{
+				const key_type first;
+				value_type second;
+			};
+
+		private:
+			using offset = std::uint64_t;		//position of a node in the file, 0 (the header) is null
+			struct node{
+				entry value;
+				offset parent;
+				offset left;
+				offset right;
+				int height;
+			};
+			struct header{
+				char magic[4];
+				std::uint32_t version;
+				std::uint32_t key_size;
+				std::uint32_t value_size;
+				std::uint32_t node_size;
+				std::uint32_t state;			//clean or dirty
+				offset root;
+				std::uint64_t size;
+				offset used;					//end of the nodes allocated so far
+				offset free;					//erased nodes, linked through left
+			};
+			static constexpr offset first_node = 64;
+			static_assert(sizeof(header) <= first_node && alignof(node) <= first_node, "the header doesn't fit");
+			static constexpr std::uint32_t clean = 0, dirty = 1;
+			static constexpr size_t initial_size = 1 << 16;
+
+			comp_op compare;
+			int fd;
+			char* base;
+			size_t mapped;						//bytes mapped, the size of the file
+			std::string name;
+			bool was_clean;
+
+			header& head() const noexcept { return *reinterpret_cast<header*>(base); }
+			node& at(offset x) const noexcept { return *reinterpret_cast<node*>(base + x); }
+			int node_height(offset x) const noexcept { return x ? at(x).height : 0; }
+
+			[[noreturn]] void fail(const std::string& what) const { throw std::runtime_error("bst: " + what + " " + name); }
+
+			void map(size_t bytes){
+				void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if(p == MAP_FAILED)
+					fail("cannot map");
+				base = static_cast<char*>(p);
+				mapped = bytes;
+			}
+			void unmap() noexcept{
+				if(base)
+					::munmap(base, mapped);
+				base = nullptr;
+			}
+			//Make the file at least bytes long: doubled, and mapped again (the offsets don't change)
+			void grow(size_t bytes){
+				size_t page = ::sysconf(_SC_PAGESIZE);
+				size_t n = std::max(2 * mapped, (bytes + page - 1) / page * page);
+				if(::ftruncate(fd, n) != 0)
+					fail("cannot grow");
+				unmap();
+				map(n);
+			}
+			//Called before every change: the dirty mark is on disk before any node changes
+			void touch(){
+				if(head().state == dirty)
+					return;
+				head().state = dirty;
+				if(::msync(base, first_node, MS_SYNC) != 0)
+					fail("cannot sync");
+			}
+
+			//A node from the free list or from the end of the file, which may be mapped again
+			offset allocate(){
+				offset x = head().free;
+				if(x){
+					head().free = at(x).left;
+					return x;
+				}
+				if(head().used + sizeof(node) > mapped)
+					grow(head().used + sizeof(node));
+				x = head().used;
+				head().used += sizeof(node);
+				return x;
+			}
+			void release(offset x) noexcept{
+				at(x).left = head().free;
+				head().free = x;
+			}
+
+			offset find_node(const key_type& k) const;
+			offset lower_node(const key_type& k) const;
+			std::pair<offset, bool> insert_aux(const key_type& k, const value_type& v, bool assign);
+			void replace_child(offset p, offset old, offset now) noexcept;
+			void update(offset x) noexcept { at(x).height = 1 + std::max(node_height(at(x).left), node_height(at(x).right)); }
+			offset rotate_left(offset x) noexcept;
+			offset rotate_right(offset x) noexcept;
+			//Rebalance the nodes from x up to the root, stops where the height of a subtree didn't change
+			void retrace(offset x) noexcept;
+
+		public:
+			template <class T>
+			class basic_iterator{
+				const MappedBst* tree;
+				offset x;
+				friend class MappedBst;
+
+				public:
+					basic_iterator(): tree{nullptr}, x{0} {}
+					basic_iterator(const MappedBst* t, offset n): tree{t}, x{n} {}
+					//iterator to const_iterator
+					template <class U, class = typename std::enable_if<std::is_const<T>::value && !std::is_const<U>::value>::type>
+					basic_iterator(const basic_iterator<U>& it): tree{it.tree}, x{it.x} {}
+					template <class U> friend class basic_iterator;
+
+					using val_type = T;
+					using difference_type = std::ptrdiff_t;
+					using iterator_category = std::forward_iterator_tag;
+					using reference = T&;
+					using pointer = T*;
+
+					reference operator*() const noexcept { return tree->at(x).value; }
+					pointer operator->() const noexcept { return &(*(*this)); }
+
+					basic_iterator& operator++() noexcept{
+						if(tree->at(x).right){					//leftmost node of the right subtree
+							x = tree->at(x).right;
+							while(tree->at(x).left)
+								x = tree->at(x).left;
+							return *this;
+						}
+						offset p = tree->at(x).parent;			//or the first ancestor reached from the left
+						while(p && tree->at(p).right == x){
+							x = p;
+							p = tree->at(p).parent;
+						}
+						x = p;
+						return *this;
+					}
+					basic_iterator operator++(int) noexcept{
+						basic_iterator tmp{*this};
+						++(*this);
+						return tmp;
+					}
+					friend bool operator==(const basic_iterator& a, const basic_iterator& b) noexcept { return a.x == b.x; }
+					friend bool operator!=(const basic_iterator& a, const basic_iterator& b) noexcept { return a.x != b.x; }
+			};
+			using iterator = basic_iterator<entry>;
+			using const_iterator = basic_iterator<const entry>;
+
+			//Open the tree in the file path, which is created if it doesn't exist ==> MappedBst<k,v> tree{"tree.map"};
+			explicit MappedBst(const std::string& path, comp_op comp = comp_op());
+			~MappedBst(){
+				try{
+					sync();
+				}catch(...){}							//the pages are written back by the system anyway
+				unmap();
+				::close(fd);
+			}
+
+			MappedBst(const MappedBst&) = delete;
+			MappedBst& operator=(const MappedBst&) = delete;
+
+			size_t size() const noexcept { return head().size; }
+			bool empty() const noexcept { return head().size == 0; }
+			int height() const noexcept { return node_height(head().root); }
+			//Was the file synced when it was opened? If not, the last changes before a crash may be half done
+			bool opened_clean() const noexcept { return was_clean; }
+
+			iterator begin() noexcept { return iterator(this, leftmost()); }
+			iterator end() noexcept { return iterator(this, 0); }
+			const_iterator begin() const noexcept { return const_iterator(this, leftmost()); }
+			const_iterator end() const noexcept { return const_iterator(this, 0); }
+			const_iterator cbegin() const noexcept { return begin(); }
+			const_iterator cend() const noexcept { return end(); }
+
+			iterator find(const key_type& k) { return iterator(this, find_node(k)); }
+			const_iterator find(const key_type& k) const { return const_iterator(this, find_node(k)); }
+			bool contains(const key_type& k) const { return find_node(k) != 0; }
+			//First pair whose key is not less than k
+			iterator lower_bound(const key_type& k) { return iterator(this, lower_node(k)); }
+			const_iterator lower_bound(const key_type& k) const { return const_iterator(this, lower_node(k)); }
+
+			//insert a pair ==> tree.insert({key,value}), returns false if the key was already there
+			std::pair<iterator, bool> insert(const std::pair<key_type, value_type>& x){
+				auto r = insert_aux(x.first, x.second, false);
+				return {iterator(this, r.first), r.second};
+			}
+			//insert a pair or replace the value of the key ==> tree.insert_or_assign({key,value})
+			std::pair<iterator, bool> insert_or_assign(const std::pair<key_type, value_type>& x){
+				auto r = insert_aux(x.first, x.second, true);
+				return {iterator(this, r.first), r.second};
+			}
+			//The reference is into the mapping: it dangles once an insert grows the file, keep an iterator instead
+			value_type& operator[](const key_type& k) { return at(insert_aux(k, value_type(), false).first).value.second; }
+			//Erase the pair of the key k ==> tree.erase(key), returns the number of pairs erased (0 or 1)
+			size_t erase(const key_type& k);
+			//Erase every pair, the file keeps its size
+			void clear(){
+				touch();
+				head().root = 0;
+				head().size = 0;
+				head().used = first_node;
+				head().free = 0;
+			}
+			//Durability point: write every change to the file ==> tree.sync();
+			void sync();
+
+			//on printing the tree, the tree follows inorder traversal.
+			friend std::ostream& operator<<(std::ostream& os, const MappedBst& tree){
+				for(auto it = tree.cbegin(); it != tree.cend(); ++it)
+					os << (*it).second << " ";
+				return os;
+			}
+
+		private:
+			offset leftmost() const noexcept{
+				offset x = head().root;
+				while(x && at(x).left)
+					x = at(x).left;
+				return x;
+			}
+	};
+
+/*
+******* OPEN *******
+*A new file gets a header and room for some nodes; an existing one is only mapped and its header checked.
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	MappedBst<key_type, value_type, comp_op>::MappedBst(const std::string& path, comp_op comp): compare{comp}, fd{-1}, base{nullptr}, mapped{0}, name{path}, was_clean{true} {
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if(fd < 0)
+			fail("cannot open");
+		try{
+			struct stat st;
+			if(::fstat(fd, &st) != 0)
+				fail("cannot open");
+			if(st.st_size == 0){
+				if(::ftruncate(fd, initial_size) != 0)
+					fail("cannot grow");
+				map(initial_size);
+				header& h = head();
+				std::memcpy(h.magic, "BSTM", 4);
+				h.version = 1;
+				h.key_size = sizeof(key_type);
+				h.value_size = sizeof(value_type);
+				h.node_size = sizeof(node);
+				h.state = clean;
+				h.root = 0;
+				h.size = 0;
+				h.used = first_node;
+				h.free = 0;
+				if(::msync(base, first_node, MS_SYNC) != 0)
+					fail("cannot sync");
+			}else{
+				if(size_t(st.st_size) < first_node)
+					fail("not a tree file:");
+				map(st.st_size);
+				const header& h = head();
+				if(std::memcmp(h.magic, "BSTM", 4) != 0 || h.version != 1)
+					fail("not a tree file:");
+				if(h.key_size != sizeof(key_type) || h.value_size != sizeof(value_type) || h.node_size != sizeof(node))
+					fail("the nodes don't match the key and value types in");
+				if(h.used > mapped)
+					fail("truncated file");
+				was_clean = h.state == clean;
+			}
+		}catch(...){
+			unmap();
+			::close(fd);
+			throw;
+		}
+}
+
+/*
+******* SYNC *******
+*The nodes are written first, then the header is marked clean and written.
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	void MappedBst<key_type, value_type, comp_op>::sync(){
+		if(head().state == clean)
+			return;
+		if(::msync(base, mapped, MS_SYNC) != 0)
+			fail("cannot sync");
+		head().state = clean;
+		if(::msync(base, first_node, MS_SYNC) != 0)
+			fail("cannot sync");
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename MappedBst<key_type, value_type, comp_op>::offset MappedBst<key_type, value_type, comp_op>::find_node(const key_type& k) const{
+		offset x = head().root;
+		while(x){
+			if(compare(k, at(x).value.first))
+				x = at(x).left;
+			else if(compare(at(x).value.first, k))
+				x = at(x).right;
+			else
+				return x;
+		}
+		return 0;
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename MappedBst<key_type, value_type, comp_op>::offset MappedBst<key_type, value_type, comp_op>::lower_node(const key_type& k) const{
+		offset x = head().root, result = 0;
+		while(x){
+			if(compare(at(x).value.first, k))
+				x = at(x).right;
+			else{
+				result = x;
+				x = at(x).left;
+			}
+		}
+		return result;
+}
+
+/*
+******* INSERT *******
+*The key and the value are copied first: they may be in the file, which can be mapped again by allocate.
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	std::pair<typename MappedBst<key_type, value_type, comp_op>::offset, bool> MappedBst<key_type, value_type, comp_op>::insert_aux(const key_type& key, const value_type& value, bool assign){
+		const key_type k = key;
+		const value_type v = value;
+		offset p = 0, x = head().root;
+		bool left = false;
+		while(x){
+			p = x;
+			if((left = compare(k, at(x).value.first)))
+				x = at(x).left;
+			else if(compare(at(x).value.first, k))
+				x = at(x).right;
+			else{
+				if(assign){
+					touch();
+					at(x).value.second = v;
+				}
+				return {x, false};
+			}
+		}
+		touch();
+		x = allocate();
+		::new (static_cast<void*>(&at(x))) node{entry{k, v}, p, 0, 0, 1};
+		if(!p)
+			head().root = x;
+		else if(left)
+			at(p).left = x;
+		else
+			at(p).right = x;
+		++head().size;
+		retrace(p);
+		return {x, true};
+}
+
+/*
+******* ERASE *******
+*A node with two children is replaced by its successor, whose node is moved to its place (as swap_node
+*does in the Bst): only the node of the key erased is released, the iterators to the other keys stay valid.
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	size_t MappedBst<key_type, value_type, comp_op>::erase(const key_type& k){
+		offset x = find_node(k);
+		if(!x)
+			return 0;
+		touch();
+		offset p = at(x).parent;					//the lowest node whose subtree changes
+		if(at(x).left && at(x).right){
+			offset s = at(x).right;
+			while(at(s).left)
+				s = at(s).left;
+			if(at(s).parent != x){					//take s out, its right child goes to its place
+				p = at(s).parent;
+				offset r = at(s).right;
+				at(p).left = r;
+				if(r)
+					at(r).parent = p;
+				at(s).right = at(x).right;
+				at(at(s).right).parent = s;
+			}else
+				p = s;
+			at(s).left = at(x).left;
+			at(at(s).left).parent = s;
+			at(s).parent = at(x).parent;
+			at(s).height = at(x).height;
+			replace_child(at(x).parent, x, s);
+		}else{
+			offset c = at(x).left ? at(x).left : at(x).right;
+			if(c)
+				at(c).parent = p;
+			replace_child(p, x, c);
+		}
+		release(x);
+		--head().size;
+		retrace(p);
+		return 1;
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	void MappedBst<key_type, value_type, comp_op>::replace_child(offset p, offset old, offset now) noexcept{
+		if(!p)
+			head().root = now;
+		else if(at(p).left == old)
+			at(p).left = now;
+		else
+			at(p).right = now;
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename MappedBst<key_type, value_type, comp_op>::offset MappedBst<key_type, value_type, comp_op>::rotate_left(offset x) noexcept{
+		offset y = at(x).right;
+		offset b = at(y).left;
+		at(x).right = b;
+		if(b)
+			at(b).parent = x;
+		at(y).parent = at(x).parent;
+		replace_child(at(x).parent, x, y);
+		at(y).left = x;
+		at(x).parent = y;
+		update(x);
+		update(y);
+		return y;
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename MappedBst<key_type, value_type, comp_op>::offset MappedBst<key_type, value_type, comp_op>::rotate_right(offset x) noexcept{
+		offset y = at(x).left;
+		offset b = at(y).right;
+		at(x).left = b;
+		if(b)
+			at(b).parent = x;
+		at(y).parent = at(x).parent;
+		replace_child(at(x).parent, x, y);
+		at(y).right = x;
+		at(x).parent = y;
+		update(x);
+		update(y);
+		return y;
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	void MappedBst<key_type, value_type, comp_op>::retrace(offset x) noexcept{
+		while(x){
+			int old_height = at(x).height;
+			offset l = at(x).left, r = at(x).right;
+			int balance = node_height(l) - node_height(r);
+			if(balance > 1){										//left heavy
+				if(node_height(at(l).left) < node_height(at(l).right))
+					rotate_left(l);
+				x = rotate_right(x);
+			}else if(balance < -1){									//right heavy
+				if(node_height(at(r).right) < node_height(at(r).left))
+					rotate_right(r);
+				x = rotate_left(x);
+			}else
+				update(x);
+			if(at(x).height == old_height)							//nothing changes above
+				return;
+			x = at(x).parent;
+		}
+}
+
+#endif
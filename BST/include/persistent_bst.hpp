@@ -0,0 +1,254 @@
+#ifndef __persistent_bst_hpp
+#define __persistent_bst_hpp
+
+#include <iostream>
+#include <utility>
+#include <memory>
+#include <algorithm>
+#include <vector>
+
+/*
+*************** Class PERSISTENT BINARY SEARCH TREE ****************
+*A binary search tree whose nodes are never modified once built (an AVL tree).
+*insert and erase copy only the nodes on the path from the root to the key they touch
+*(O(log n) nodes) and share every other subtree with the previous version through
+*reference counted pointers. Hence
+*1. SNAPSHOT --> tree.snapshot() (or a plain copy) gives a version in O(1)
+*2. A version stays readable, and unchanged, while the tree it was taken from keeps changing,
+*   also from another thread: the versions share only immutable nodes.
+*A node is freed when no version uses it anymore.
+*It supports insert, insert_or_assign, erase, find and in-order iteration.
+*Since the nodes are shared, the values are read-only: use insert_or_assign to change a value.
+*/
+template <typename key_type, typename value_type, typename comp_op = std::less<key_type>>
+	class PersistentBst{
+		public:
+			using pair_type = std::pair<const key_type, value_type>;
+
+		private:
+			struct node;
+			using link = std::shared_ptr<const node>;
+			struct node{
+				pair_type value;
+				link left;
+				link right;
+				int height;
+
+				node(const pair_type& v, link l, link r): value{v}, left{std::move(l)}, right{std::move(r)},
+					height{1 + std::max(node_height(left), node_height(right))} {}
+			};
+
+			comp_op compare;
+			link root;
+			size_t n;
+
+			static int node_height(const link& x) noexcept { return x ? x->height : 0; }
+			static link make(const pair_type& v, link l, link r) { return std::make_shared<const node>(v, std::move(l), std::move(r)); }
+
+			//New node with value v and subtrees l and r, rotated if their heights differ by more than one
+			static link balance(const pair_type& v, link l, link r);
+			//The following return the root of the new version of the subtree t, which is t itself if nothing changed
+			link insert_aux(const link& t, const pair_type& x, bool assign, bool& inserted);
+			link erase_aux(const link& t, const key_type& x, bool& erased);
+			static link remove_min(const link& t, const pair_type*& min);
+
+		public:
+			//Iterator visiting the pairs in order. It keeps the path from the root to the current node,
+			//it is valid as long as the version it comes from is not changed (take a snapshot to be sure).
+			class const_iterator{
+				std::vector<const node*> path;
+
+				void push_left(const node* x){
+					for(; x; x = x->left.get())
+						path.push_back(x);
+				}
+				friend class PersistentBst;
+
+				public:
+					const_iterator() = default;
+					explicit const_iterator(const node* x) { push_left(x); }
+
+					friend bool operator==(const const_iterator& a, const const_iterator& b) {
+						return (a.path.empty() ? nullptr : a.path.back()) == (b.path.empty() ? nullptr : b.path.back());
+					}
+					friend bool operator!=(const const_iterator& a, const const_iterator& b) { return !(a == b); }
+
+					using val_type = const pair_type;
+					using difference_type = std::ptrdiff_t;
+					using iterator_category = std::forward_iterator_tag;
+					using reference = val_type&;
+					using pointer = val_type*;
+
+					reference operator*() const noexcept { return path.back()->value; }
+					pointer operator->() const noexcept { return &(*(*this)); }
+
+					const_iterator& operator++(){
+						const node* x = path.back();
+						path.pop_back();
+						push_left(x->right.get());		//the successor is the leftmost node of the right subtree,
+						return *this;					//or the closest ancestor still on the path
+					}
+					const_iterator operator++(int){
+						const_iterator tmp{*this};
+						++(*this);
+						return tmp;
+					}
+			};
+			using iterator = const_iterator;
+
+			PersistentBst(): compare{comp_op()}, root{nullptr}, n{0} {}
+			PersistentBst(comp_op comp): compare{comp}, root{nullptr}, n{0} {}
+
+			//A snapshot of the current version in O(1) ==> auto version = tree.snapshot();
+			PersistentBst snapshot() const { return *this; }
+
+			size_t size() const noexcept { return n; }
+			bool empty() const noexcept { return n == 0; }
+			int height() const noexcept { return node_height(root); }
+
+			const_iterator begin() const { return const_iterator(root.get()); }
+			const_iterator end() const { return const_iterator(); }
+			const_iterator cbegin() const { return begin(); }
+			const_iterator cend() const { return end(); }
+
+			//find a value
+			const_iterator find(const key_type& x) const;
+
+			//insert a value ==> tree.insert({key,value}), returns false if the key was already there
+			bool insert(const pair_type& x){
+				bool inserted = false;
+				root = insert_aux(root, x, false, inserted);
+				n += inserted;
+				return inserted;
+			}
+			//insert a value or replace the value of the key ==> tree.insert_or_assign({key,value})
+			bool insert_or_assign(const pair_type& x){
+				bool inserted = false;
+				root = insert_aux(root, x, true, inserted);
+				n += inserted;
+				return inserted;
+			}
+			//Erase the node associated with the particular key x ==> tree.erase(key)
+			void erase(const key_type& x){
+				bool erased = false;
+				root = erase_aux(root, x, erased);
+				if(!erased)
+					std::cout << "The given key doesn't exist" << std::endl;
+				n -= erased;
+			}
+			//Clear this version, the snapshots are left untouched
+			void clear() noexcept{
+				root.reset();
+				n = 0;
+			}
+
+			//on printing the tree, the tree follows inorder traversal.
+			friend std::ostream& operator<<(std::ostream& os, const PersistentBst& tree){
+				for(auto it = tree.cbegin(); it != tree.cend(); ++it)
+					os << (*it).second << " ";
+				return os;
+			}
+};
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename PersistentBst<key_type, value_type, comp_op>::link PersistentBst<key_type, value_type, comp_op>::balance(const pair_type& v, link l, link r){
+		int hl = node_height(l), hr = node_height(r);
+		if(hl > hr + 1){														//left heavy
+			if(node_height(l->left) >= node_height(l->right))
+				return make(l->value, l->left, make(v, l->right, std::move(r)));	//single rotation
+			const link& lr = l->right;											//double rotation
+			return make(lr->value, make(l->value, l->left, lr->left), make(v, lr->right, std::move(r)));
+		}
+		if(hr > hl + 1){														//right heavy
+			if(node_height(r->right) >= node_height(r->left))
+				return make(r->value, make(v, std::move(l), r->left), r->right);
+			const link& rl = r->left;
+			return make(rl->value, make(v, std::move(l), rl->left), make(r->value, rl->right, r->right));
+		}
+		return make(v, std::move(l), std::move(r));
+}
+
+/*
+******* INSERT *******
+*The nodes on the path to the key are copied bottom up and rebalanced; the subtrees off the path are shared.
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	typename PersistentBst<key_type, value_type, comp_op>::link PersistentBst<key_type, value_type, comp_op>::insert_aux(const link& t, const pair_type& x, bool assign, bool& inserted){
+		if(!t){
+			inserted = true;
+			return make(x, nullptr, nullptr);
+		}
+		if(compare(x.first, t->value.first)){
+			link l = insert_aux(t->left, x, assign, inserted);
+			if(l == t->left)
+				return t;						//nothing changed below, nothing to copy
+			return balance(t->value, std::move(l), t->right);
+		}
+		if(compare(t->value.first, x.first)){
+			link r = insert_aux(t->right, x, assign, inserted);
+			if(r == t->right)
+				return t;
+			return balance(t->value, t->left, std::move(r));
+		}
+		if(assign)
+			return make(x, t->left, t->right);	//same shape, new value
+		return t;
+}
+
+/*
+******* ERASE *******
+*A node with two children is replaced by the minimum of its right subtree.
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	typename PersistentBst<key_type, value_type, comp_op>::link PersistentBst<key_type, value_type, comp_op>::remove_min(const link& t, const pair_type*& min){
+		if(!t->left){
+			min = &t->value;
+			return t->right;
+		}
+		return balance(t->value, remove_min(t->left, min), t->right);
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename PersistentBst<key_type, value_type, comp_op>::link PersistentBst<key_type, value_type, comp_op>::erase_aux(const link& t, const key_type& x, bool& erased){
+		if(!t)
+			return t;
+		if(compare(x, t->value.first)){
+			link l = erase_aux(t->left, x, erased);
+			if(l == t->left)
+				return t;
+			return balance(t->value, std::move(l), t->right);
+		}
+		if(compare(t->value.first, x)){
+			link r = erase_aux(t->right, x, erased);
+			if(r == t->right)
+				return t;
+			return balance(t->value, t->left, std::move(r));
+		}
+		erased = true;
+		if(!t->left)
+			return t->right;
+		if(!t->right)
+			return t->left;
+		const pair_type* min = nullptr;
+		link r = remove_min(t->right, min);		//the old right subtree keeps the minimum node alive
+		return balance(*min, t->left, std::move(r));
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename PersistentBst<key_type, value_type, comp_op>::const_iterator PersistentBst<key_type, value_type, comp_op>::find(const key_type& x) const{
+		const_iterator it;
+		const node* t = root.get();
+		while(t){
+			it.path.push_back(t);
+			if(compare(x, t->value.first)){
+				t = t->left.get();
+			}else if(compare(t->value.first, x)){
+				it.path.pop_back();					//the successors are only the nodes where we went left
+				t = t->right.get();
+			}else
+				return it;
+		}
+		return end();
+}
+
+#endif
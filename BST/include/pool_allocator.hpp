@@ -0,0 +1,165 @@
+#ifndef __pool_allocator_hpp
+#define __pool_allocator_hpp
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <type_traits>
+
+/*
+************* Class POOL ALLOCATOR *****************
+*An allocator handing out objects of type T from contiguous blocks (slabs)
+*of block_size objects each, to be used as the allocator of the Bst:
+*Bst<key, value, std::less<key>, unbalanced, pool_allocator<std::pair<const key, value>>> tree;
+*
+*Single objects are served from the free list of recycled slots first, then from
+*the last block; a new block is allocated only when the last one is exhausted.
+*Deallocated objects go back to the free list, so erase/insert churn never reaches malloc.
+*All the copies of an allocator share the same pools, which are freed with the last copy:
+*copying or moving an allocator, or rebinding it to another type, never makes a new pool,
+*so a moved-from allocator is still usable and compares equal to the one it was moved to.
+*There is one pool per slot size and alignment, shared by the types that fit them.
+*Every pool counts the objects living in it: release_all(n) gives back every block of the pool in
+*O(blocks) when the n objects the caller is done with are all of them, whoever else shares the pools
+*(a moved-from tree, a copy from get_allocator()). The Bst uses it in clear() when the nodes don't
+*need to be destroyed one by one; a tree sharing the pool with another one frees its nodes one by one.
+*As the std containers, the allocators sharing the pools are not to be used from several threads at once.
+*/
+//The pools of the pool_allocators of one block size, whatever the type of their objects
+template <std::size_t block_size>
+	struct slab_pools{
+		//The slots of one size carved out of blocks; a free slot links to the next free one
+		struct pool{
+			struct free_slot{ free_slot* next; };
+			const std::size_t size;			//bytes per slot, a multiple of align
+			const std::size_t align;
+			std::vector<std::unique_ptr<char[]>> blocks;
+			char* first = nullptr;			//first aligned slot of the last block
+			free_slot* free_list = nullptr;	//recycled slots
+			std::size_t used = block_size;	//slots handed out from the last block
+			std::size_t live = 0;			//objects allocated and not deallocated
+
+			pool(std::size_t s, std::size_t a): size{s}, align{a} {}
+			void* get(){
+				++live;
+				if(free_list){
+					free_slot* s = free_list;
+					free_list = s->next;
+					return s;
+				}
+				if(used == block_size){
+					blocks.emplace_back(new char[block_size * size + align]);
+					std::uintptr_t start = reinterpret_cast<std::uintptr_t>(blocks.back().get());
+					first = blocks.back().get() + (align - start % align) % align;
+					used = 0;
+				}
+				return first + size * used++;
+			}
+			void put(void* s) noexcept{
+				--live;
+				free_list = new (s) free_slot{free_list};
+			}
+			void release() noexcept{
+				blocks.clear();
+				first = nullptr;
+				free_list = nullptr;
+				used = block_size;
+				live = 0;
+			}
+		};
+
+		//The pools shared by an allocator and all its copies and rebound copies, one per slot size
+		struct pool_set{
+			std::vector<std::unique_ptr<pool>> pools;
+
+			pool* find(std::size_t size, std::size_t align) const noexcept{
+				for(auto& x : pools)
+					if(x->size == size && x->align == align)
+						return x.get();
+				return nullptr;
+			}
+			pool* get(std::size_t size, std::size_t align){
+				if(pool* x = find(size, align))
+					return x;
+				pools.emplace_back(new pool{size, align});
+				return pools.back().get();
+			}
+		};
+	};
+
+template <typename T, std::size_t block_size = 1024>
+	class pool_allocator{
+		template <typename U, std::size_t N> friend class pool_allocator;
+		using pool = typename slab_pools<block_size>::pool;
+		using pool_set = typename slab_pools<block_size>::pool_set;
+
+		static constexpr std::size_t slot_align = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+		static constexpr std::size_t slot_size = (std::max(sizeof(T), sizeof(void*)) + slot_align - 1) / slot_align * slot_align;
+
+		std::shared_ptr<pool_set> pools;
+		pool* p = nullptr;				//the pool of the objects of type T, found on first use
+		//The pool of T, made if needed by allocate; an object to deallocate comes from it, so it exists
+		pool* existing_pool() noexcept { return p ? p : (p = pools->find(slot_size, slot_align)); }
+
+		public:
+			using value_type = T;
+			using propagate_on_container_copy_assignment = std::false_type;
+			using propagate_on_container_move_assignment = std::true_type;
+			using propagate_on_container_swap = std::true_type;
+
+			template <typename U>
+				struct rebind{ using other = pool_allocator<U, block_size>; };
+
+			pool_allocator(): pools{std::make_shared<pool_set>()} {}
+			//Rebinding shares the pools, the one of the objects of type T is made on first use
+			template <typename U>
+				pool_allocator(const pool_allocator<U, block_size>& a) noexcept: pools{a.pools} {}
+			pool_allocator(const pool_allocator&) = default;
+			pool_allocator& operator=(const pool_allocator&) = default;
+			//Moving copies: the allocator moved from keeps the pools, it has to stay usable
+			pool_allocator(pool_allocator&& a) noexcept: pools{a.pools}, p{a.p} {}
+			pool_allocator& operator=(pool_allocator&& a) noexcept{
+				pools = a.pools;
+				p = a.p;
+				return *this;
+			}
+
+			//A copied container gets fresh pools
+			pool_allocator select_on_container_copy_construction() const { return pool_allocator{}; }
+
+			T* allocate(std::size_t n){
+				if(n != 1)
+					return static_cast<T*>(::operator new(n * sizeof(T)));
+				if(!p)
+					p = pools->get(slot_size, slot_align);
+				return static_cast<T*>(p->get());
+			}
+			void deallocate(T* x, std::size_t n) noexcept{
+				if(n != 1){
+					::operator delete(x);
+					return;
+				}
+				existing_pool()->put(x);
+			}
+
+			//Free every block of the pool of T at once, the n objects given back are not destroyed.
+			//Nothing is done (and false is returned) if other objects live in the pool: they belong
+			//to another container sharing it.
+			bool release_all(std::size_t n) noexcept{
+				pool* x = existing_pool();
+				if(!x)
+					return n == 0;
+				if(x->live != n)
+					return false;
+				x->release();
+				return true;
+			}
+
+			friend bool operator==(const pool_allocator& a, const pool_allocator& b) noexcept { return a.pools == b.pools; }
+			friend bool operator!=(const pool_allocator& a, const pool_allocator& b) noexcept { return !(a == b); }
+};
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef __serializer_hpp
+#define __serializer_hpp
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+*************** BINARY FILES OF THE BST ****************
+*The format written by tree.save(path) and read back by tree.load(path):
+*1. HEADER --> "BSTF", a byte order mark, the format version, the record sizes and the number of records
+*2. RECORDS --> the keys and values in the order of the tree, one after the other, without padding
+*The files are written in the byte order of the machine, which is checked on loading.
+*
+*The keys and values are written by serializer<T>: the trivially copyable types are copied byte by
+*byte, std::string as its length followed by its characters. For any other type specialize it:
+*   template <> struct serializer<my_type>{
+*       static constexpr std::uint32_t fixed_size = 0;      //size of every record, 0 if it varies
+*       static void write(binary_writer& out, const my_type& x);
+*       static my_type read(binary_reader& in);
+*   };
+*or give the serializers to save and load ==> tree.save<my_key_io, my_value_io>(path)
+*/
+
+namespace bst_file{
+	const char magic[4] = {'B', 'S', 'T', 'F'};
+	const std::uint32_t byte_order = 0x01020304;		//read back in another order on a machine of the other endianness
+	const std::uint32_t version = 1;
+
+	//Make a rename into the directory of path durable: the entry lives in the directory, which is synced (POSIX)
+	inline void sync_directory_of(const std::string& path){
+#if defined(__unix__) || defined(__APPLE__)
+		const size_t slash = path.find_last_of('/');
+		const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+		int fd = ::open(dir.c_str(), O_RDONLY);
+		if(fd < 0)
+			throw std::runtime_error("bst: cannot open the directory " + dir);
+		int r = ::fsync(fd);
+		::close(fd);
+		if(r != 0)
+			throw std::runtime_error("bst: cannot sync the directory " + dir);
+#else
+		(void)path;
+#endif
+	}
+}
+
+//Buffered writer on a file, the data reaches the file on flush() or close().
+//Built without a file it only collects the data in memory, see data() and size().
+class binary_writer{
+	std::FILE* f;
+	std::string name;
+	std::vector<char> buf;
+	size_t used;
+
+	[[noreturn]] void fail(const char* what) const { throw std::runtime_error("bst: cannot " + std::string(what) + " " + name); }
+
+	public:
+		explicit binary_writer(const std::string& path, size_t buffer = 1 << 20): f{std::fopen(path.c_str(), "wb")}, name{path}, buf(buffer), used{0} {
+			if(!f)
+				fail("create");
+			std::setvbuf(f, nullptr, _IONBF, 0);		//the buffer is ours, the stream would copy everything twice
+		}
+		binary_writer(): f{nullptr}, used{0} {}
+		~binary_writer() { if(f) std::fclose(f); }
+
+		binary_writer(const binary_writer&) = delete;
+		binary_writer& operator=(const binary_writer&) = delete;
+
+		void write(const void* p, size_t n){
+			if(n > buf.size() - used){
+				if(!f){								//in memory: make room
+					buf.resize(std::max(2 * buf.size(), used + n));
+					std::memcpy(buf.data() + used, p, n);
+					used += n;
+					return;
+				}
+				flush();
+				if(n > buf.size()){					//larger than the buffer: straight to the file
+					if(std::fwrite(p, 1, n, f) != n)
+						fail("write");
+					return;
+				}
+			}
+			std::memcpy(buf.data() + used, p, n);
+			used += n;
+		}
+		//An unsigned integer in 7 bit groups, the small ones (lengths) take a single byte
+		void write_varint(std::uint64_t x){
+			unsigned char b[10];
+			size_t n = 0;
+			for(; x >= 0x80; x >>= 7)
+				b[n++] = static_cast<unsigned char>(x | 0x80);
+			b[n++] = static_cast<unsigned char>(x);
+			write(b, n);
+		}
+		//The data written so far and not flushed
+		const char* data() const noexcept { return buf.data(); }
+		size_t size() const noexcept { return used; }
+		void clear() noexcept { used = 0; }
+		void flush(){
+			if(!f)
+				return;
+			if(used && std::fwrite(buf.data(), 1, used, f) != used)
+				fail("write");
+			used = 0;
+		}
+		//Flush, make the data durable if sync and close the file (nothing to do in memory)
+		void close(bool sync = true){
+			flush();
+			if(!f)
+				return;
+			if(std::fflush(f) != 0)
+				fail("write");
+#if defined(__unix__) || defined(__APPLE__)
+			if(sync && ::fsync(fileno(f)) != 0)
+				fail("sync");
+#else
+			(void)sync;
+#endif
+			int r = std::fclose(f);
+			f = nullptr;
+			if(r != 0)
+				fail("close");
+		}
+};
+
+//Buffered reader on a file, it throws if the file ends before the data asked for.
+//Built from a vector it reads the vector.
+class binary_reader{
+	std::FILE* f;
+	std::string name;
+	std::vector<char> buf;
+	size_t pos;
+	size_t end;
+	std::uint64_t unread;				//bytes of the file not read into the buffer yet
+
+	[[noreturn]] void fail(const char* what) const { throw std::runtime_error("bst: " + std::string(what) + " " + name); }
+
+	bool refill(){
+		if(!f)
+			return false;
+		pos = 0;
+		end = std::fread(buf.data(), 1, buf.size(), f);
+		if(end == 0 && std::ferror(f))
+			fail("cannot read");
+		unread -= std::min<std::uint64_t>(unread, end);
+		return end > 0;
+	}
+
+	public:
+		explicit binary_reader(const std::string& path, size_t buffer = 1 << 20): f{std::fopen(path.c_str(), "rb")}, name{path}, buf(buffer), pos{0}, end{0}, unread{0} {
+			if(!f)
+				fail("cannot open");
+			std::setvbuf(f, nullptr, _IONBF, 0);
+			long size = -1;
+			if(std::fseek(f, 0, SEEK_END) == 0)
+				size = std::ftell(f);
+			if(std::fseek(f, 0, SEEK_SET) != 0)
+				fail("cannot read");
+			unread = size < 0 ? UINT64_MAX : std::uint64_t(size);	//not a regular file: no limit known
+		}
+		explicit binary_reader(std::vector<char> data): f{nullptr}, name{"buffer"}, buf(std::move(data)), pos{0}, end{buf.size()}, unread{0} {}
+		~binary_reader() { if(f) std::fclose(f); }
+
+		binary_reader(const binary_reader&) = delete;
+		binary_reader& operator=(const binary_reader&) = delete;
+
+		void read(void* p, size_t n){
+			if(n <= end - pos){						//the common case: the record is in the buffer
+				std::memcpy(p, buf.data() + pos, n);
+				pos += n;
+				return;
+			}
+			if(read_some(p, n) != n)
+				fail("unexpected end of");
+		}
+		//Read up to n bytes, fewer only at the end of the file; returns the bytes read
+		size_t read_some(void* p, size_t n){
+			char* out = static_cast<char*>(p);
+			size_t done = 0;
+			while(done < n){
+				if(pos == end && !refill())
+					break;
+				size_t k = std::min(n - done, end - pos);
+				std::memcpy(out + done, buf.data() + pos, k);
+				pos += k;
+				done += k;
+			}
+			return done;
+		}
+		bool at_end() { return pos == end && !refill(); }
+		//Bytes left to read (at most: the file may be shorter than its size said when it was opened)
+		std::uint64_t remaining() const noexcept { return unread == UINT64_MAX ? unread : (end - pos) + unread; }
+		//The length of n objects of elem_size bytes, checked against the bytes left before anything is
+		//allocated for them: a corrupt length throws instead of asking for up to 2^64 bytes
+		size_t read_length(size_t elem_size){
+			std::uint64_t n = read_varint();
+			if(n > remaining() / elem_size)
+				fail("bad length in");
+			return size_t(n);
+		}
+		std::uint64_t read_varint(){
+			std::uint64_t x = 0;
+			for(int shift = 0; shift < 64; shift += 7){
+				unsigned char b;
+				read(&b, 1);
+				x |= std::uint64_t(b & 0x7f) << shift;
+				if(!(b & 0x80))
+					return x;
+			}
+			fail("bad length in");
+		}
+};
+
+//Trivially copyable types: their bytes
+template <class T>
+	struct serializer{
+		static_assert(std::is_trivially_copyable<T>::value, "no serializer for this type: specialize serializer<T>");
+		static constexpr std::uint32_t fixed_size = sizeof(T);
+
+		static void write(binary_writer& out, const T& x) { out.write(&x, sizeof(T)); }
+		static T read(binary_reader& in){
+			T x;
+			in.read(&x, sizeof(T));
+			return x;
+		}
+	};
+
+//Strings: the length, then the characters
+template <class C, class Traits, class A>
+	struct serializer<std::basic_string<C, Traits, A>>{
+		using string_type = std::basic_string<C, Traits, A>;
+		static constexpr std::uint32_t fixed_size = 0;
+
+		static void write(binary_writer& out, const string_type& x){
+			out.write_varint(x.size());
+			out.write(x.data(), x.size() * sizeof(C));
+		}
+		static string_type read(binary_reader& in){
+			string_type x(in.read_length(sizeof(C)), C());
+			if(!x.empty())
+				in.read(&x[0], x.size() * sizeof(C));
+			return x;
+		}
+	};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef __thread_pool_hpp
+#define __thread_pool_hpp
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+/*
+************* Class THREAD POOL *****************
+*A work-stealing pool of std::thread workers, used by the parallel operations of the Bst.
+*Every worker has its own queue of tasks: it takes the newest task of its own queue first
+*(the tasks it just spawned, still hot in its cache) and, when it runs out, steals the oldest
+*task of another queue (the largest pieces of work, when the work is split recursively).
+*Tasks submitted from outside the pool are spread over the queues round robin.
+*
+*A task_group collects tasks and waits for them; the waiting thread runs tasks of the pool
+*meanwhile, so a pool of 0 workers runs everything in the thread that waits. When no task is
+*left in the queues it sleeps until the tasks of the group run by other threads are done.
+*/
+class thread_pool{
+	struct queue{
+		std::mutex m;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<queue>> queues;		//queues[i] belongs to the worker i
+	std::vector<std::thread> workers;
+	std::atomic<size_t> queued;						//tasks waiting in the queues
+	std::atomic<size_t> next;						//queue of the next task submitted from outside
+	std::mutex sleep_m;
+	std::condition_variable wake;
+	bool stop;
+
+	//The pool and the index of the worker running on this thread (nullptr outside the pools)
+	static thread_pool*& this_pool() noexcept { static thread_local thread_pool* p = nullptr; return p; }
+	static size_t& this_worker() noexcept { static thread_local size_t i = 0; return i; }
+
+	bool pop(size_t i, bool own, std::function<void()>& task){
+		std::lock_guard<std::mutex> lock{queues[i]->m};
+		auto& tasks = queues[i]->tasks;
+		if(tasks.empty())
+			return false;
+		if(own){
+			task = std::move(tasks.back());
+			tasks.pop_back();
+		}else{
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		--queued;
+		return true;
+	}
+
+	void work(size_t i){
+		this_pool() = this;
+		this_worker() = i;
+		while(true){
+			if(run_one())
+				continue;
+			std::unique_lock<std::mutex> lock{sleep_m};
+			wake.wait(lock, [this]{ return stop || queued > 0; });
+			if(stop && queued == 0)
+				return;
+		}
+	}
+
+	public:
+		explicit thread_pool(size_t n = std::thread::hardware_concurrency()): queued{0}, next{0}, stop{false} {
+			size_t n_queues = n ? n : 1;			//without workers the tasks still need a queue
+			for(size_t i = 0; i < n_queues; i++)
+				queues.emplace_back(new queue);
+			try{
+				for(size_t i = 0; i < n; i++)
+					workers.emplace_back([this, i]{ work(i); });
+			}catch(...){
+				shutdown();
+				throw;
+			}
+		}
+		~thread_pool() { shutdown(); }
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		//The pool used when none is given ==> thread_pool::shared()
+		static thread_pool& shared(){
+			static thread_pool pool;
+			return pool;
+		}
+
+		size_t size() const noexcept { return workers.size(); }
+
+		//Queue a task, on the own queue when called from a worker of this pool
+		void submit(std::function<void()> task){
+			size_t i = (this_pool() == this) ? this_worker() : next++ % queues.size();
+			{
+				std::lock_guard<std::mutex> lock{queues[i]->m};
+				queues[i]->tasks.push_back(std::move(task));
+			}
+			++queued;
+			{
+				std::lock_guard<std::mutex> lock{sleep_m};		//a worker going to sleep sees either the task or the notification
+			}
+			wake.notify_one();
+		}
+
+		//Run one queued task if there is any: the own newest one or the oldest one of another queue
+		bool run_one(){
+			size_t n = queues.size();
+			size_t self = (this_pool() == this) ? this_worker() : 0;
+			std::function<void()> task;
+			bool found = (this_pool() == this) && pop(self, true, task);
+			for(size_t k = 0; !found && k < n; k++)
+				found = pop((self + k) % n, false, task);
+			if(found)
+				task();
+			return found;
+		}
+
+		void shutdown() noexcept{
+			{
+				std::lock_guard<std::mutex> lock{sleep_m};
+				stop = true;
+			}
+			wake.notify_all();
+			for(auto& w : workers)
+				if(w.joinable())
+					w.join();
+		}
+};
+
+/*
+*A set of tasks run on a pool ==> task_group g{pool}; g.run(f1); g.run(f2); g.wait();
+*wait() returns when all the tasks are done and rethrows the first exception thrown by one of them.
+*/
+class task_group{
+	thread_pool& pool;
+	std::atomic<size_t> pending;
+	std::mutex error_m;
+	std::exception_ptr error;
+	std::mutex done_m;
+	std::condition_variable done;
+
+	//The last task wakes the waiter; under the lock, so the group outlives the notification
+	void finish(){
+		std::lock_guard<std::mutex> lock{done_m};
+		if(--pending == 0)
+			done.notify_all();
+	}
+	//Help with the queued tasks, then sleep until the ones run by other threads are done
+	void join(){
+		while(pending > 0 && pool.run_one())
+			;
+		std::unique_lock<std::mutex> lock{done_m};
+		done.wait(lock, [this]{ return pending == 0; });
+	}
+
+	public:
+		explicit task_group(thread_pool& p) noexcept: pool{p}, pending{0} {}
+		~task_group() { join(); }					//don't leave the tasks with a dangling group
+
+		template <class F>
+		void run(F f){
+			++pending;
+			try{
+				pool.submit([this, f]() mutable {
+					try{
+						f();
+					}catch(...){
+						std::lock_guard<std::mutex> lock{error_m};
+						if(!error)
+							error = std::current_exception();
+					}
+					finish();
+				});
+			}catch(...){
+				finish();
+				throw;
+			}
+		}
+
+		void wait(){
+			join();
+			if(error){
+				std::exception_ptr e = error;
+				error = nullptr;
+				std::rethrow_exception(e);
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,396 @@
+#ifndef __wal_hpp
+#define __wal_hpp
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bst.hpp"
+#include "serializer.hpp"
+
+/*
+*************** WRITE AHEAD LOG ****************
+*An append-only file of the changes of a tree (put key value, erase key), used to get them back
+*after a crash: the tree is loaded from its last snapshot (save/load) and the log is replayed on it.
+*The changes are only encoded in memory by the calling thread; a writer thread appends them to the
+*file and syncs it (POSIX fsync) according to the fsync policy:
+*1. ALWAYS --> every batch is synced before the next one is written. The changes queued while a sync
+*   is running are written and synced together (group commit): one fsync for many changes.
+*2. INTERVAL --> synced at most once per interval: a crash loses at most the last interval.
+*3. NEVER --> left to the system, synced only by flush() and when the log is closed.
+*flush() returns when every change queued before it is on disk, whatever the policy.
+*
+*The file is a sequence of batches: the payload length, its checksum (FNV-1a) and the records, each
+*an operation byte, the key and for a put the value (written by serializer<T>, see serializer.hpp).
+*A batch cut by a crash fails its checksum: replay stops there and cuts it off the file.
+*A write error of the writer thread is thrown by the next call on the log.
+*/
+enum class fsync_policy { always, interval, never };
+
+//What replay found ==> records / seconds is the replay rate
+struct replay_stats{
+	size_t records = 0;			//changes replayed
+	size_t bytes = 0;			//bytes of the valid batches
+	double seconds = 0;
+	bool torn_tail = false;		//the last batch was cut by a crash and dropped
+};
+
+template <typename key_type, typename value_type, class key_io = serializer<key_type>, class value_io = serializer<value_type>>
+	class write_ahead_log{
+		static constexpr char put_op = 'P', erase_op = 'E';
+		using clock = std::chrono::steady_clock;
+
+		int fd;
+		std::string name;
+		fsync_policy policy;
+		clock::duration interval;
+
+		std::mutex m;
+		std::condition_variable work;		//to the writer: something to write or to sync
+		std::condition_variable done;		//from the writer: a batch is written
+		binary_writer buffers[2];
+		binary_writer* filling;				//the buffer of the changes queued, the other one is being written
+		std::uint64_t queued;				//changes queued since the log was opened
+		std::uint64_t synced;				//of which on disk
+		bool sync_wanted;
+		bool stop;
+		std::exception_ptr error;
+		std::thread writer;
+
+		static std::uint32_t checksum(const char* p, size_t n) noexcept{
+			std::uint32_t h = 2166136261u;
+			for(size_t i = 0; i < n; i++)
+				h = (h ^ static_cast<unsigned char>(p[i])) * 16777619u;
+			return h;
+		}
+		[[noreturn]] void fail(const char* what) const { throw std::runtime_error("bst: cannot " + std::string(what) + " " + name); }
+
+		void write_all(const char* p, size_t n){
+			while(n > 0){
+				ssize_t k = ::write(fd, p, n);
+				if(k < 0){
+					if(errno == EINTR)
+						continue;
+					fail("write");
+				}
+				p += k;
+				n -= k;
+			}
+		}
+		void write_batch(const binary_writer& b){
+			const std::uint32_t frame[2] = {static_cast<std::uint32_t>(b.size()), checksum(b.data(), b.size())};
+			write_all(reinterpret_cast<const char*>(frame), sizeof(frame));
+			write_all(b.data(), b.size());
+		}
+		void sync_file(){
+			if(::fsync(fd) != 0)
+				fail("sync");
+		}
+		void rethrow_error(){
+			if(error)
+				std::rethrow_exception(error);
+		}
+
+		void run();
+
+		//The record is encoded under the lock: the buffer may be handed to the writer at any time.
+		//The writer is woken only by the first change of a buffer, it takes the others with it.
+		template <class F>
+		void enqueue(F encode){
+			bool first;
+			{
+				std::lock_guard<std::mutex> lock{m};
+				rethrow_error();
+				first = filling->size() == 0;
+				encode(*filling);
+				++queued;
+			}
+			if(first)
+				work.notify_one();
+		}
+
+	public:
+		//Open the log path for appending, it is created if it doesn't exist
+		//==> write_ahead_log<k,v> log{"tree.log", fsync_policy::interval, std::chrono::milliseconds(10)};
+		explicit write_ahead_log(const std::string& path, fsync_policy p = fsync_policy::always,
+								 clock::duration sync_interval = std::chrono::milliseconds(100))
+			: fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)}, name{path}, policy{p}, interval{sync_interval},
+			  filling{&buffers[0]}, queued{0}, synced{0}, sync_wanted{false}, stop{false} {
+			if(fd < 0)
+				fail("open");
+			try{
+				writer = std::thread([this]{ run(); });
+			}catch(...){
+				::close(fd);
+				throw;
+			}
+		}
+		//Write and sync what is left, then close
+		~write_ahead_log(){
+			{
+				std::lock_guard<std::mutex> lock{m};
+				stop = true;
+			}
+			work.notify_one();
+			writer.join();
+			::close(fd);
+		}
+
+		write_ahead_log(const write_ahead_log&) = delete;
+		write_ahead_log& operator=(const write_ahead_log&) = delete;
+
+		void put(const key_type& k, const value_type& v){
+			enqueue([&](binary_writer& out){
+				const char op = put_op;
+				out.write(&op, 1);
+				key_io::write(out, k);
+				value_io::write(out, v);
+			});
+		}
+		void erase(const key_type& k){
+			enqueue([&](binary_writer& out){
+				const char op = erase_op;
+				out.write(&op, 1);
+				key_io::write(out, k);
+			});
+		}
+		//Wait until every change queued so far is on disk ==> log.flush();
+		void flush(){
+			std::unique_lock<std::mutex> lock{m};
+			std::uint64_t target = queued;
+			if(synced < target && !error){
+				sync_wanted = true;
+				work.notify_one();
+				done.wait(lock, [&]{ return synced >= target || error; });
+			}
+			rethrow_error();
+		}
+		//Empty the log, once the changes are in a snapshot. It must not run together with put or erase.
+		void reset(){
+			flush();
+			std::lock_guard<std::mutex> lock{m};
+			if(::ftruncate(fd, 0) != 0)
+				fail("truncate");
+			sync_file();
+		}
+
+		//Call put(key, value) and erase(key) on the changes of the log path, in order ==> write_ahead_log<k,v>::replay(path, put, erase)
+		template <class Put, class Erase>
+		static replay_stats replay(const std::string& path, Put put, Erase erase);
+	};
+
+/*
+******* WRITER THREAD *******
+*It takes the whole buffer of the queued changes at once and leaves the other (empty) one to the callers,
+*so the callers never wait for the disk; with the interval policy it wakes up to sync on time.
+*/
+template <typename key_type, typename value_type, class key_io, class value_io>
+	void write_ahead_log<key_type, value_type, key_io, value_io>::run(){
+		std::unique_lock<std::mutex> lock{m};
+		clock::time_point last_sync = clock::now();
+		std::uint64_t written = 0;
+		auto ready = [this]{ return stop || filling->size() > 0 || sync_wanted; };
+		while(true){
+			if(policy == fsync_policy::interval && written > synced)
+				work.wait_until(lock, last_sync + interval, ready);
+			else
+				work.wait(lock, ready);
+			binary_writer* batch = filling;
+			filling = (filling == &buffers[0]) ? &buffers[1] : &buffers[0];
+			std::uint64_t target = queued;
+			bool last = stop;
+			bool sync = sync_wanted || last || policy == fsync_policy::always ||
+						(policy == fsync_policy::interval && clock::now() >= last_sync + interval);
+			sync_wanted = false;
+			lock.unlock();
+			try{
+				if(batch->size() > 0)
+					write_batch(*batch);
+				batch->clear();
+				if(sync && target > synced){			//synced only changes under the lock, by this thread
+					sync_file();
+					last_sync = clock::now();
+				}
+			}catch(...){
+				lock.lock();
+				error = std::current_exception();
+				done.notify_all();
+				return;
+			}
+			lock.lock();
+			written = target;
+			if(sync)
+				synced = target;
+			done.notify_all();
+			if(last)
+				return;
+		}
+}
+
+/*
+******* REPLAY *******
+*The batches are checked before any of their changes is applied: a torn batch is never half replayed.
+*/
+template <typename key_type, typename value_type, class key_io, class value_io>
+	template <class Put, class Erase>
+	replay_stats write_ahead_log<key_type, value_type, key_io, value_io>::replay(const std::string& path, Put put, Erase erase){
+		replay_stats stats;
+		auto start = clock::now();
+		if(::access(path.c_str(), F_OK) != 0)
+			return stats;							//no log, nothing to replay
+		{
+			binary_reader in{path};
+			while(true){
+				std::uint32_t frame[2];
+				size_t got = in.read_some(frame, sizeof(frame));
+				if(got == 0)
+					break;
+				std::vector<char> payload;
+				if(got == sizeof(frame)){
+					payload.resize(frame[0]);
+					got = in.read_some(payload.data(), payload.size());
+				}
+				if(got != payload.size() || payload.empty() || checksum(payload.data(), payload.size()) != frame[1]){
+					stats.torn_tail = true;
+					break;
+				}
+				stats.bytes += sizeof(frame) + payload.size();
+				binary_reader records{std::move(payload)};
+				while(!records.at_end()){
+					char op;
+					records.read(&op, 1);
+					key_type k = key_io::read(records);
+					if(op == put_op)
+						put(std::move(k), value_io::read(records));
+					else if(op == erase_op)
+						erase(k);
+					else
+						throw std::runtime_error("bst: bad record in " + path);
+					++stats.records;
+				}
+			}
+		}
+		if(stats.torn_tail && ::truncate(path.c_str(), stats.bytes) != 0)
+			throw std::runtime_error("bst: cannot truncate " + path);
+		stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+		return stats;
+}
+
+/*
+*************** Class LOGGED BINARY SEARCH TREE ****************
+*A Bst whose changes are written to a write ahead log: a crash loses nothing that the fsync policy
+*(or a flush) put on disk. It is opened from a snapshot file and a log file:
+*   LoggedBst<int, int> tree{"tree.bst", "tree.log", fsync_policy::always};
+*loads the snapshot (if any) and replays the log on it, tree.recovered() tells how it went.
+*tree.checkpoint() saves a new snapshot and empties the log. If a crash comes in between, the old log
+*is replayed on the new snapshot, which gives the same tree: a put sets and an erase removes.
+*The tree is read through tree.get(); the changes go through insert, insert_or_assign, erase and
+*operator[], which returns a proxy logging the assignments (tree[k] = v).
+*/
+template <typename key_type, typename value_type, typename comp_op = std::less<key_type>, typename balance_policy = avl_balanced,
+			typename alloc_type = std::allocator<std::pair<const key_type, value_type>>>
+	class LoggedBst{
+		public:
+			using tree_type = Bst<key_type, value_type, comp_op, balance_policy, alloc_type>;
+			using log_type = write_ahead_log<key_type, value_type>;
+
+		private:
+			tree_type tree;
+			std::string snapshot;
+			replay_stats stats;
+			log_type log;
+
+			//Load the snapshot and replay the log on it, before the log is opened for appending
+			static replay_stats recover(tree_type& tree, const std::string& snapshot, const std::string& log){
+				if(::access(snapshot.c_str(), F_OK) == 0)
+					tree.load(snapshot);
+				return log_type::replay(log, [&](key_type&& k, value_type&& v){
+					auto r = tree.try_emplace(std::move(k), v);
+					if(!r.second)
+						(*r.first).second = std::move(v);
+				}, [&](const key_type& k){
+					if(tree.contains(k))
+						tree.erase(k);
+				});
+			}
+
+		public:
+			//The value of a key: assigning it is logged
+			class reference{
+				LoggedBst& owner;
+				typename tree_type::iterator it;
+				friend class LoggedBst;
+				reference(LoggedBst& o, typename tree_type::iterator i): owner{o}, it{i} {}
+
+				public:
+					reference& operator=(const value_type& v){
+						(*it).second = v;
+						owner.log.put((*it).first, v);
+						return *this;
+					}
+					operator const value_type&() const noexcept { return (*it).second; }
+			};
+
+			LoggedBst(const std::string& snapshot_path, const std::string& log_path, fsync_policy p = fsync_policy::always,
+					  std::chrono::steady_clock::duration sync_interval = std::chrono::milliseconds(100))
+				: tree{}, snapshot{snapshot_path}, stats{recover(tree, snapshot_path, log_path)}, log{log_path, p, sync_interval} {}
+
+			const tree_type& get() const noexcept { return tree; }
+			const replay_stats& recovered() const noexcept { return stats; }
+			size_t size() const noexcept { return tree.size(); }
+
+			//insert a pair ==> tree.insert({key,value}), only a new key is logged
+			std::pair<typename tree_type::const_iterator, bool> insert(const std::pair<const key_type, value_type>& x){
+				auto r = tree.insert(x);
+				if(r.second)
+					log.put(x.first, x.second);
+				return r;
+			}
+			//insert a pair or replace the value of the key ==> tree.insert_or_assign({key,value})
+			//As everywhere, the change is logged after the tree took it: a throwing insert logs nothing
+			bool insert_or_assign(const std::pair<const key_type, value_type>& x){
+				auto r = tree.try_emplace(x.first, x.second);
+				if(!r.second)
+					(*r.first).second = x.second;
+				log.put(x.first, x.second);
+				return r.second;
+			}
+			//Erase the node associated with the particular key x ==> tree.erase(key), a missing key is a no-op
+			void erase(const key_type& x){
+				if(!tree.contains(x))
+					return;
+				tree.erase(x);
+				log.erase(x);
+			}
+			//A key missing from the tree is inserted with a default value, which is logged
+			reference operator[](const key_type& x){
+				auto r = tree.find_or_insert(x);
+				if(r.second)
+					log.put(x, (*r.first).second);
+				return reference(*this, r.first);
+			}
+
+			//Wait until every change so far is on disk ==> tree.flush();
+			void flush() { log.flush(); }
+			//Save a snapshot and empty the log ==> tree.checkpoint();
+			void checkpoint(){
+				log.flush();
+				tree.save(snapshot);
+				log.reset();
+			}
+
+			//on printing the tree, the tree follows inorder traversal.
+			friend std::ostream& operator<<(std::ostream& os, const LoggedBst& tree) { return os << tree.tree; }
+	};
+
+#endif
@@ -0,0 +1,550 @@
+#ifndef __wide_bst_hpp
+#define __wide_bst_hpp
+
+#include <iostream>
+#include <utility>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+*************** Class WIDE BINARY SEARCH TREE ****************
+*A search tree with wide nodes (a B+ tree) offering the same find/insert/erase/iterator
+*operations as the Bst. Every node holds a block of keys as large as a cache line
+*(16 int, 8 double, ...), so a lookup misses the cache once per level of a tree of
+*height log_16(n) instead of once per level of a tree of height log_2(n).
+*The key/value pairs live in the leaves, which are linked in order for the iteration;
+*the inner nodes only hold separators: the first key of each child but the first one.
+*
+*For arithmetic keys compared with std::less or std::greater the position of a key inside
+*a node is found comparing the whole block at once with SSE2 (or AVX2 when compiled with -mavx2)
+*and counting the bits of the resulting mask. Other keys use a branchless scalar loop.
+*
+*Keys and values have to be default constructible. Erase frees the leaves left empty
+*but doesn't merge half empty nodes, so the height never exceeds the one reached by the inserts.
+*/
+
+//Number of keys per node: a cache line of keys, at least 4
+template <typename key_type>
+	struct wide_capacity : std::integral_constant<int, (sizeof(key_type) <= 16 ? 64/sizeof(key_type) : 4)> {};
+
+/*
+****** In-node search ******
+*before(keys, n, x)    --> number of the n keys k for which compare(k, x) (position of lower_bound)
+*not_after(keys, n, x) --> number of the n keys k for which !compare(x, k) (position of upper_bound)
+*The keys of a node are sorted, so counting the comparisons gives the position without branching.
+*/
+template <typename key_type, typename comp_op, typename = void>
+	struct wide_search{
+		static int before(const key_type* keys, int n, const key_type& x, const comp_op& compare){
+			int r = 0;
+			for(int i = 0; i < n; i++)
+				r += compare(keys[i], x);
+			return r;
+		}
+		static int not_after(const key_type* keys, int n, const key_type& x, const comp_op& compare){
+			int r = 0;
+			for(int i = 0; i < n; i++)
+				r += !compare(x, keys[i]);
+			return r;
+		}
+};
+
+//Vector comparisons of a whole node (64 bytes) of keys against x: bit i of the mask is set if keys[i] < x (resp. >)
+template <typename key_type, typename = void>
+	struct simd_keys : std::false_type {};
+
+#if defined(__SSE2__)
+template <typename key_type>
+	struct simd_keys<key_type, typename std::enable_if<std::is_integral<key_type>::value && std::is_signed<key_type>::value && sizeof(key_type) == 4>::type> : std::true_type{
+#if defined(__AVX2__)
+		static unsigned mask(const key_type* keys, key_type x, bool less) noexcept{
+			__m256i v = _mm256_set1_epi32(x);
+			unsigned m = 0;
+			for(int i = 0; i < 16; i += 8){
+				__m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+				__m256i c = less ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+				m |= unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(c))) << i;
+			}
+			return m;
+		}
+#else
+		static unsigned mask(const key_type* keys, key_type x, bool less) noexcept{
+			__m128i v = _mm_set1_epi32(x);
+			unsigned m = 0;
+			for(int i = 0; i < 16; i += 4){
+				__m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+				__m128i c = less ? _mm_cmplt_epi32(k, v) : _mm_cmpgt_epi32(k, v);
+				m |= unsigned(_mm_movemask_ps(_mm_castsi128_ps(c))) << i;
+			}
+			return m;
+		}
+#endif
+};
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+template <typename key_type>
+	struct simd_keys<key_type, typename std::enable_if<std::is_integral<key_type>::value && std::is_signed<key_type>::value && sizeof(key_type) == 8>::type> : std::true_type{
+		static unsigned mask(const key_type* keys, key_type x, bool less) noexcept{
+			__m128i v = _mm_set1_epi64x(x);
+			unsigned m = 0;
+			for(int i = 0; i < 8; i += 2){
+				__m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+				__m128i c = less ? _mm_cmpgt_epi64(v, k) : _mm_cmpgt_epi64(k, v);
+				m |= unsigned(_mm_movemask_pd(_mm_castsi128_pd(c))) << i;
+			}
+			return m;
+		}
+};
+#endif
+
+template <>
+	struct simd_keys<float> : std::true_type{
+		static unsigned mask(const float* keys, float x, bool less) noexcept{
+			__m128 v = _mm_set1_ps(x);
+			unsigned m = 0;
+			for(int i = 0; i < 16; i += 4){
+				__m128 k = _mm_loadu_ps(keys + i);
+				m |= unsigned(_mm_movemask_ps(less ? _mm_cmplt_ps(k, v) : _mm_cmpgt_ps(k, v))) << i;
+			}
+			return m;
+		}
+};
+
+template <>
+	struct simd_keys<double> : std::true_type{
+		static unsigned mask(const double* keys, double x, bool less) noexcept{
+			__m128d v = _mm_set1_pd(x);
+			unsigned m = 0;
+			for(int i = 0; i < 8; i += 2){
+				__m128d k = _mm_loadu_pd(keys + i);
+				m |= unsigned(_mm_movemask_pd(less ? _mm_cmplt_pd(k, v) : _mm_cmpgt_pd(k, v))) << i;
+			}
+			return m;
+		}
+};
+#endif
+
+//std::less: compare(k, x) is k < x and compare(x, k) is k > x
+template <typename key_type>
+	struct wide_search<key_type, std::less<key_type>, typename std::enable_if<simd_keys<key_type>::value>::type>{
+		static int before(const key_type* keys, int n, const key_type& x, const std::less<key_type>&) noexcept{
+			return __builtin_popcount(simd_keys<key_type>::mask(keys, x, true) & ((1u << n) - 1));
+		}
+		static int not_after(const key_type* keys, int n, const key_type& x, const std::less<key_type>&) noexcept{
+			return n - __builtin_popcount(simd_keys<key_type>::mask(keys, x, false) & ((1u << n) - 1));
+		}
+};
+
+//std::greater: compare(k, x) is k > x and compare(x, k) is k < x
+template <typename key_type>
+	struct wide_search<key_type, std::greater<key_type>, typename std::enable_if<simd_keys<key_type>::value>::type>{
+		static int before(const key_type* keys, int n, const key_type& x, const std::greater<key_type>&) noexcept{
+			return __builtin_popcount(simd_keys<key_type>::mask(keys, x, false) & ((1u << n) - 1));
+		}
+		static int not_after(const key_type* keys, int n, const key_type& x, const std::greater<key_type>&) noexcept{
+			return n - __builtin_popcount(simd_keys<key_type>::mask(keys, x, true) & ((1u << n) - 1));
+		}
+};
+
+template <typename key_type, typename value_type, typename comp_op = std::less<key_type>>
+	class WideBst{
+		static constexpr int capacity = wide_capacity<key_type>::value;
+		using search = wide_search<key_type, comp_op>;
+
+		struct inner_node;
+		struct node_base{
+			bool leaf;
+			int count;							//number of keys in the node
+			inner_node* parent;
+			key_type keys[capacity];
+
+			explicit node_base(bool l): leaf{l}, count{0}, parent{nullptr}, keys{} {}
+		};
+		struct leaf_node : node_base{
+			value_type values[capacity];		//values[i] is associated with keys[i]
+			leaf_node* prev;					//the leaves are linked in order
+			leaf_node* next;
+
+			leaf_node(): node_base{true}, values{}, prev{nullptr}, next{nullptr} {}
+		};
+		struct inner_node : node_base{
+			node_base* children[capacity+1];	//count+1 children, keys[i] is the first key under children[i+1]
+
+			inner_node(): node_base{false}, children{} {}
+		};
+
+		comp_op compare;
+		node_base* root;
+		leaf_node* head;						//the first leaf
+		size_t n;
+
+		//Go down to the leaf which may contain x
+		leaf_node* find_leaf(const key_type& x) const noexcept{
+			node_base* t = root;
+			while(!t->leaf){
+				inner_node* in = static_cast<inner_node*>(t);
+				t = in->children[search::not_after(in->keys, in->count, x, compare)];
+			}
+			return static_cast<leaf_node*>(t);
+		}
+		static int child_index(inner_node* p, node_base* c) noexcept{
+			int i = 0;
+			while(p->children[i] != c)
+				++i;
+			return i;
+		}
+		//Split a full leaf in two halves, the new one is returned
+		leaf_node* split_leaf(leaf_node* l);
+		//Insert the separator sep and the new node right after the node left in the parent of left
+		void insert_separator(node_base* left, const key_type& sep, node_base* right);
+		//Remove an empty node from its parent, removing the parents left empty as well
+		void remove_node(node_base* c) noexcept;
+		void destroy(node_base* t) noexcept;
+		node_base* clone(const node_base* t, inner_node* p, leaf_node*& last);
+
+		template <typename V>
+			class __wide_iterator{
+				leaf_node* l;
+				int i;
+				friend class WideBst;
+
+				public:
+					__wide_iterator(leaf_node* x, int j) noexcept: l{x}, i{j} {}
+
+					friend bool operator==(const __wide_iterator& a, const __wide_iterator& b) { return a.l == b.l && a.i == b.i; }
+					friend bool operator!=(const __wide_iterator& a, const __wide_iterator& b) { return !(a == b); }
+
+					using val_type = std::pair<const key_type&, V&>;
+					using difference_type = std::ptrdiff_t;
+					using iterator_category = std::forward_iterator_tag;
+					using reference = val_type;
+					struct pointer{
+						val_type p;
+						const val_type* operator->() const noexcept { return &p; }
+					};
+
+					reference operator*() const noexcept { return val_type(l->keys[i], l->values[i]); }
+					pointer operator->() const noexcept { return pointer{*(*this)}; }
+
+					__wide_iterator& operator++() noexcept{
+						if(++i == l->count){		//move to the first key of the next leaf
+							l = l->next;
+							i = 0;
+						}
+						return *this;
+					}
+					__wide_iterator operator++(int) noexcept{
+						__wide_iterator tmp{*this};
+						++(*this);
+						return tmp;
+					}
+			};
+
+		public:
+			using pair_type = std::pair<const key_type, value_type>;
+			using iterator = __wide_iterator<value_type>;
+			using const_iterator = __wide_iterator<const value_type>;
+
+			WideBst(): compare{comp_op()}, root{nullptr}, head{nullptr}, n{0} {}
+			WideBst(comp_op comp): compare{comp}, root{nullptr}, head{nullptr}, n{0} {}
+			~WideBst() noexcept { clear(); }
+
+			WideBst(const WideBst& tree): compare{tree.compare}, root{nullptr}, head{nullptr}, n{tree.n}{
+				leaf_node* last = nullptr;
+				if(tree.root)
+					root = clone(tree.root, nullptr, last);
+			}
+			WideBst& operator=(const WideBst& tree){
+				if(&tree == this)
+					return *this;
+				WideBst tmp{tree};
+				*this = std::move(tmp);
+				return *this;
+			}
+			WideBst(WideBst&& tree) noexcept: compare{std::move(tree.compare)}, root{tree.root}, head{tree.head}, n{tree.n}{
+				tree.root = nullptr;
+				tree.head = nullptr;
+				tree.n = 0;
+			}
+			WideBst& operator=(WideBst&& tree) noexcept{
+				if(&tree == this)
+					return *this;
+				clear();
+				compare = std::move(tree.compare);
+				root = tree.root;
+				head = tree.head;
+				n = tree.n;
+				tree.root = nullptr;
+				tree.head = nullptr;
+				tree.n = 0;
+				return *this;
+			}
+
+			iterator begin() noexcept { return iterator(head, 0); }
+			iterator end() noexcept { return iterator(nullptr, 0); }
+			const_iterator begin() const noexcept { return const_iterator(head, 0); }
+			const_iterator end() const noexcept { return const_iterator(nullptr, 0); }
+			const_iterator cbegin() const noexcept { return const_iterator(head, 0); }
+			const_iterator cend() const noexcept { return const_iterator(nullptr, 0); }
+
+			size_t size() const noexcept { return n; }
+			bool empty() const noexcept { return n == 0; }
+
+			//find a value
+			iterator find(const key_type& x) noexcept{
+				if(!root)
+					return end();
+				leaf_node* l = find_leaf(x);
+				int i = search::before(l->keys, l->count, x, compare);
+				if(i < l->count && !compare(x, l->keys[i]))
+					return iterator(l, i);
+				return end();
+			}
+			const_iterator find(const key_type& x) const noexcept{
+				auto it = const_cast<WideBst*>(this)->find(x);
+				return const_iterator(it.l, it.i);
+			}
+
+			//insert a value  ==> tree.insert({key,value})
+			std::pair<iterator, bool> insert(const pair_type& x) { return insert_aux(x.first, x.second); }
+			std::pair<iterator, bool> insert(pair_type&& x) { return insert_aux(x.first, std::move(x.second)); }
+
+			//Insert values both as pair_type or key_type,value_type
+			template<class... Types>
+			std::pair<iterator,bool> emplace(Types&&... args) { return insert(pair_type(std::forward<Types>(args)...)); }
+
+			//Erase the key x ==> tree.erase(key)
+			void erase(const key_type& x);
+			//Clear the entire tree ==> tree.clear();
+			void clear() noexcept{
+				if(root)
+					destroy(root);
+				root = nullptr;
+				head = nullptr;
+				n = 0;
+			}
+
+			//Operator overloading
+			value_type& operator[](const key_type& x) { return (*insert_aux(x, value_type{}).first).second; }
+
+			//on printing the tree, the tree follows inorder traversal.
+			friend std::ostream& operator<<(std::ostream& os, const WideBst& tree){
+				for(auto it = tree.cbegin(); it != tree.cend(); ++it)
+					os << (*it).second << " ";
+				return os;
+			}
+
+		private:
+			template <class V>
+			std::pair<iterator, bool> insert_aux(const key_type& k, V&& v);
+};
+
+/*
+******* INSERT *******
+*Find the leaf and the position of the key. If the leaf is full it is split in two halves first,
+*and the first key of the new leaf is added as separator to the parent (splitting it if needed,
+*up to the root, which is the only way the tree grows in height).
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	template <class V>
+	std::pair<typename WideBst<key_type, value_type, comp_op>::iterator, bool> WideBst<key_type, value_type, comp_op>::insert_aux(const key_type& k, V&& v){
+		if(!root){
+			head = new leaf_node;
+			root = head;
+		}
+		leaf_node* l = find_leaf(k);
+		int i = search::before(l->keys, l->count, k, compare);
+		if(i < l->count && !compare(k, l->keys[i]))
+			return std::make_pair(iterator(l, i), false);			//the key is already there
+		if(l->count == capacity){
+			leaf_node* r = split_leaf(l);
+			if(i > l->count){										//the key goes to the new leaf
+				i -= l->count;
+				l = r;
+			}
+		}
+		for(int j = l->count; j > i; j--){							//make room at i
+			l->keys[j] = std::move(l->keys[j-1]);
+			l->values[j] = std::move(l->values[j-1]);
+		}
+		l->keys[i] = k;
+		l->values[i] = std::forward<V>(v);
+		++l->count;
+		++n;
+		return std::make_pair(iterator(l, i), true);
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	typename WideBst<key_type, value_type, comp_op>::leaf_node* WideBst<key_type, value_type, comp_op>::split_leaf(leaf_node* l){
+		leaf_node* r = new leaf_node;
+		int h = l->count / 2;
+		for(int j = h; j < l->count; j++){
+			r->keys[j-h] = std::move(l->keys[j]);
+			r->values[j-h] = std::move(l->values[j]);
+		}
+		r->count = l->count - h;
+		l->count = h;
+		r->next = l->next;											//link the new leaf after l
+		if(r->next) r->next->prev = r;
+		r->prev = l;
+		l->next = r;
+		insert_separator(l, r->keys[0], r);
+		return r;
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	void WideBst<key_type, value_type, comp_op>::insert_separator(node_base* left, const key_type& sep, node_base* right){
+		inner_node* p = left->parent;
+		if(!p){														//left was the root: the tree grows by one level
+			inner_node* r = new inner_node;
+			r->keys[0] = sep;
+			r->children[0] = left;
+			r->children[1] = right;
+			r->count = 1;
+			left->parent = r;
+			right->parent = r;
+			root = r;
+			return;
+		}
+		int idx = child_index(p, left);
+		if(p->count < capacity){
+			for(int j = p->count; j > idx; j--){
+				p->keys[j] = std::move(p->keys[j-1]);
+				p->children[j+1] = p->children[j];
+			}
+			p->keys[idx] = sep;
+			p->children[idx+1] = right;
+			right->parent = p;
+			++p->count;
+			return;
+		}
+		//The parent is full: gather its capacity+1 keys and split them around the middle one,
+		//which moves up to the grandparent
+		key_type keys[capacity+1];
+		node_base* children[capacity+2];
+		for(int j = 0, s = 0; j <= capacity; j++){
+			if(j == idx){
+				keys[j] = sep;
+			}else
+				keys[j] = std::move(p->keys[s++]);
+		}
+		for(int j = 0, s = 0; j <= capacity+1; j++){
+			if(j == idx+1)
+				children[j] = right;
+			else
+				children[j] = p->children[s++];
+		}
+		int m = (capacity+1) / 2;
+		inner_node* q = new inner_node;
+		p->count = m;
+		for(int j = 0; j < m; j++)
+			p->keys[j] = std::move(keys[j]);
+		for(int j = 0; j <= m; j++){
+			p->children[j] = children[j];
+			children[j]->parent = p;
+		}
+		q->count = capacity - m;
+		for(int j = m+1; j <= capacity; j++)
+			q->keys[j-m-1] = std::move(keys[j]);
+		for(int j = m+1; j <= capacity+1; j++){
+			q->children[j-m-1] = children[j];
+			children[j]->parent = q;
+		}
+		insert_separator(p, keys[m], q);
+}
+
+/*
+******* ERASE *******
+*The pair is removed from its leaf. A leaf left empty is unlinked and removed from its parent,
+*an inner node left without children is removed in turn, and a root with a single child is
+*replaced by the child.
+*/
+template <typename key_type, typename value_type, typename comp_op>
+	void WideBst<key_type, value_type, comp_op>::erase(const key_type& x){
+		auto it = find(x);
+		if(it == end()){
+			std::cout << "The given key doesn't exist" << std::endl;
+			return;
+		}
+		leaf_node* l = it.l;
+		for(int j = it.i; j+1 < l->count; j++){
+			l->keys[j] = std::move(l->keys[j+1]);
+			l->values[j] = std::move(l->values[j+1]);
+		}
+		--l->count;
+		--n;
+		if(l->count > 0)
+			return;
+		if(l->prev) l->prev->next = l->next;
+		else head = l->next;
+		if(l->next) l->next->prev = l->prev;
+		remove_node(l);
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	void WideBst<key_type, value_type, comp_op>::remove_node(node_base* c) noexcept{
+		inner_node* p = c->parent;
+		if(c->leaf) delete static_cast<leaf_node*>(c);
+		else delete static_cast<inner_node*>(c);
+		if(!p){
+			root = nullptr;
+			return;
+		}
+		if(p->count == 0){											//c was its only child
+			remove_node(p);
+			return;
+		}
+		int idx = child_index(p, c);
+		int k = idx > 0 ? idx-1 : 0;								//the separator bounding c
+		for(int j = k; j+1 < p->count; j++)
+			p->keys[j] = std::move(p->keys[j+1]);
+		for(int j = idx; j < p->count; j++)
+			p->children[j] = p->children[j+1];
+		--p->count;
+		if(p->count == 0 && p == root){								//a root with one child is replaced by the child
+			root = p->children[0];
+			root->parent = nullptr;
+			delete p;
+		}
+}
+
+template <typename key_type, typename value_type, typename comp_op>
+	void WideBst<key_type, value_type, comp_op>::destroy(node_base* t) noexcept{
+		if(t->leaf){
+			delete static_cast<leaf_node*>(t);
+			return;
+		}
+		inner_node* in = static_cast<inner_node*>(t);
+		for(int j = 0; j <= in->count; j++)
+			destroy(in->children[j]);
+		delete in;
+}
+
+//Copy the subtree t, the copied leaves are linked after last
+template <typename key_type, typename value_type, typename comp_op>
+	typename WideBst<key_type, value_type, comp_op>::node_base* WideBst<key_type, value_type, comp_op>::clone(const node_base* t, inner_node* p, leaf_node*& last){
+		if(t->leaf){
+			leaf_node* l = new leaf_node(*static_cast<const leaf_node*>(t));
+			l->parent = p;
+			l->prev = last;
+			l->next = nullptr;
+			if(last) last->next = l;
+			else head = l;
+			last = l;
+			return l;
+		}
+		const inner_node* in = static_cast<const inner_node*>(t);
+		inner_node* c = new inner_node(*in);
+		c->parent = p;
+		for(int j = 0; j <= in->count; j++)
+			c->children[j] = clone(in->children[j], c, last);
+		return c;
+}
+
+#endif
@@ -4,8 +4,17 @@
 #include <algorithm>
 #include <vector>
 #include <cmath>
+#include <string>
+#include <cstdio>
+#include <random>
 
 #include "bst.hpp"
+#include "pool_allocator.hpp"
+#include "frozen_bst.hpp"
+#include "wide_bst.hpp"
+#include "persistent_bst.hpp"
+#include "mapped_bst.hpp"
+#include "wal.hpp"
 
 int main(){
     try{
@@ -74,6 +83,8 @@ int main(){
         tree_string.emplace("Azza", "Abdalghani");
         tree_string.emplace(std::make_pair("Giulia","Milano"));
         std::cout << "Insert using emplace :" << tree_string << std::endl;
+        Bst<std::string, std::string> tree_one{"a", "b"};		//a key and a value, not a range
+        std::cout << "Built from a key and a value :" << tree_one << std::endl;
         std::cout << std::endl;
         std::cout << std::endl;
 
@@ -107,6 +118,323 @@ int main(){
         std::cout << std::endl;
         std::cout << std::endl;
 
+        std::cout << "A self-balancing (AVL) tree filled with sorted keys" << std::endl;
+        Bst<int, int, std::less<int>, avl_balanced> tree_avl;
+        for(int i = 1; i <= 15; i++)
+            tree_avl.insert({i,i});
+        std::cout << "AVL tree :" << tree_avl << std::endl;
+        std::cout << "Breadth first :";
+        tree_avl.bfs();
+        std::cout << "Is the AVL tree balanced?" << std::endl;
+        tree_avl.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        std::cout << "Erasing the keys 1 to 7" << std::endl;
+        for(int i = 1; i <= 7; i++)
+            tree_avl.erase(i);
+        std::cout << "Breadth first :";
+        tree_avl.bfs();
+        std::cout << "Is the AVL tree still balanced?" << std::endl;
+        tree_avl.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "A degenerate tree of 2^21 nodes (almost a chain of right children)" << std::endl;
+        Bst<int, int> tree_deep;
+        std::vector<std::pair<int, int>> chunk;
+        for(int i = 0; i < (1 << 21); ){
+            chunk.clear();
+            for(int j = std::max(1, i/2 - 1); j > 0 && i < (1 << 21); j--, i++)       //small batches append at the maximum one by one
+                chunk.push_back({i,i});
+            tree_deep.insert_batch(chunk);
+        }
+        std::cout << "Height :" << tree_deep.height() << std::endl;
+        std::cout << "Is the tree balanced?" << std::endl;
+        tree_deep.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        Bst<int, int> tree_deep_copy{tree_deep};
+        std::cout << "Copied, height of the copy :" << tree_deep_copy.height() << std::endl;
+        tree_deep.clear();
+        std::cout << "Cleared, the copy is destroyed at the end of the scope" << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "An unbalanced tree keeping the heights of its nodes (cached_height)" << std::endl;
+        Bst<int, int, std::less<int>, cached_height<>> tree_cached;
+        for(int i = 1; i <= 1000; i++)
+            tree_cached.insert({i,i});
+        std::cout << "Height, read from the root :" << tree_cached.height() << std::endl;
+        std::cout << "Is the tree balanced? (O(1): its nodes out of balance are counted)" << std::endl;
+        tree_cached.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        tree_cached.balance();
+        for(int i = 1; i <= 1000; i += 2)
+            tree_cached.erase(i);
+        std::cout << "Balanced, then the odd keys erased, height :" << tree_cached.height() << std::endl;
+        std::cout << "Is the tree balanced?" << std::endl;
+        tree_cached.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        //The same random operations on a plain tree, whose height() and check_balance() walk it: the
+        //shapes are the same, so the O(1) answers of the cached tree have to match after every step
+        Bst<int, int> tree_walked;
+        Bst<int, int, std::less<int>, cached_height<>> tree_counted;
+        std::mt19937 rng_cached(7);
+        bool cached_agree = true;
+        for(int step = 0; step < 20000 && cached_agree; step++){
+            int k = rng_cached() % 500;
+            switch(rng_cached() % 8){
+                case 0: case 1: case 2:
+                    tree_walked.insert({k,k});
+                    tree_counted.insert({k,k});
+                    break;
+                case 3: case 4:
+                    if(tree_walked.find(k) != tree_walked.end()){
+                        tree_walked.erase(k);
+                        tree_counted.erase(k);
+                    }
+                    break;
+                case 5:
+                    tree_walked.extract(k);
+                    tree_counted.extract(k);
+                    break;
+                case 6:{
+                    std::vector<std::pair<int, int>> batch;
+                    for(int i = 0; i < 10; i++){
+                        int b = rng_cached() % 500;
+                        batch.push_back({b,b});
+                    }
+                    tree_walked.insert_batch(batch);
+                    tree_counted.insert_batch(batch);
+                    break;
+                }
+                default:
+                    if(rng_cached() % 64 == 0){
+                        tree_walked.balance();
+                        tree_counted.balance();
+                    }
+            }
+            cached_agree = tree_walked.height() == tree_counted.height() && tree_counted.height() == tree_counted.stats().height &&
+                           tree_walked.check_balance() == tree_counted.check_balance();
+        }
+        std::cout << "O(1) height and balance check agree with the walks over 20000 random operations? "
+                  << (cached_agree ? "true" : "false") << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Building a balanced tree from sorted pairs" << std::endl;
+        std::vector<std::pair<int, int>> sorted_pairs;
+        for(int i = 1; i <= 10; i++)
+            sorted_pairs.push_back({i, i*i});
+        Bst<int, int> tree_sorted{sorted_pairs.begin(), sorted_pairs.end()};
+        std::cout << "Tree from sorted pairs :" << tree_sorted << std::endl;
+        std::cout << "Is the tree balanced?" << std::endl;
+        tree_sorted.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        std::cout << "Assigning pairs which are not sorted (they get sorted, repeated keys are dropped)" << std::endl;
+        std::vector<std::pair<int, int>> unsorted_pairs{{5,5}, {2,2}, {9,9}, {2,20}, {7,7}};
+        tree_sorted.assign_sorted(unsorted_pairs.begin(), unsorted_pairs.end());
+        std::cout << "Tree :" << tree_sorted << std::endl;
+        std::cout << std::endl;
+        std::cout << "Building in parallel from pairs in any order (summing the values of repeated keys)" << std::endl;
+        Bst<int, int, std::less<int>, avl_balanced> tree_built;
+        std::vector<std::pair<int, int>> records{{6,1}, {3,1}, {9,1}, {3,1}, {1,1}, {6,1}, {3,1}};
+        tree_built.build_parallel(records.begin(), records.end(), 2, [](int& kept, const int& x){ kept += x; });
+        std::cout << "Tree :" << tree_built << std::endl;
+        std::cout << std::endl;
+        std::cout << "Inserting a batch of pairs" << std::endl;
+        std::vector<std::pair<int, int>> batch{{8,8}, {1,1}, {5,50}, {4,4}};
+        std::vector<bool> inserted = tree_sorted.insert_batch(batch);
+        std::cout << "Tree :" << tree_sorted << std::endl;
+        std::cout << "Inserted :";
+        for(bool b : inserted)
+            std::cout << " " << (b ? "true" : "false");
+        std::cout << std::endl;
+        std::cout << "Upserting a batch of pairs (summing the values)" << std::endl;
+        tree_sorted.upsert_batch(batch, [](int& old, const int& x){ old += x; });
+        std::cout << "Tree :" << tree_sorted << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Finding many keys at once" << std::endl;
+        std::vector<int> keys{4, 7, 100, 1};
+        std::vector<Bst<int, int>::iterator> found(keys.size(), tree_sorted.end());
+        tree_sorted.find_many(keys.begin(), keys.end(), found.begin());
+        for(size_t i = 0; i < keys.size(); i++)
+            std::cout << "Key " << keys[i] << " :" << (found[i] != tree_sorted.end() ? std::to_string((*found[i]).second) : "not found") << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Building values in place and moving nodes between trees" << std::endl;
+        Bst<int, std::string> tree_words, tree_moved;
+        tree_words.try_emplace(1, 3, 'a');									//the value is std::string(3, 'a')
+        tree_words.try_emplace(2, "two");
+        std::cout << "try_emplace on a key already there inserted? " << (tree_words.try_emplace(1, "one").second ? "true" : "false") << std::endl;
+        auto handle = tree_words.extract(1);
+        handle.mapped() += "h";
+        tree_moved.insert(std::move(handle));
+        std::cout << "Tree :" << tree_words << std::endl;
+        std::cout << "Other tree :" << tree_moved << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Inserting increasing keys with a hint (the position of the previous insert)" << std::endl;
+        Bst<int, int, std::less<int>, avl_balanced> tree_hint;
+        auto position = tree_hint.end();
+        for(int i = 1; i <= 10; i++)
+            position = tree_hint.insert(position, {i, i*10});
+        position = tree_hint.emplace_hint(position, 11, 110);
+        tree_hint[12] = 120;
+        std::cout << "Tree :" << tree_hint << std::endl;
+        std::cout << "Is the tree balanced?" << std::endl;
+        tree_hint.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "A splay tree: the keys looked up often move up toward the root" << std::endl;
+        Bst<int, int, std::less<int>, splay_balanced> tree_splay;
+        for(int i = 1; i <= 15; i++)
+            tree_splay.insert({i,i});
+        std::cout << "Height after inserting increasing keys :" << tree_splay.height() << std::endl;
+        for(int i = 0; i < 40; i++)
+            tree_splay.find(1);
+        std::cout << "Height after looking up 1 many times :" << tree_splay.height() << std::endl;
+        std::cout << "Breadth first :";
+        tree_splay.bfs();
+        std::cout << std::endl;
+
+        std::cout << "Looking up string keys without building strings (transparent comparator std::less<>)" << std::endl;
+        Bst<std::string, int, std::less<>> tree_names;
+        tree_names.insert({"apple", 1});
+        tree_names.insert({"banana", 2});
+        tree_names.insert({"cherry", 3});
+        std::cout << "Find \"banana\" :" << (*tree_names.find("banana")).second << std::endl;
+        std::cout << "Contains \"date\"? " << (tree_names.contains("date") ? "true" : "false") << std::endl;
+        tree_names["date"] = 4;
+        tree_names.erase("apple");
+        std::cout << "Tree :" << tree_names << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Saving a tree to a file and loading it back" << std::endl;
+        tree_names.save("tree_names.bst");
+        Bst<std::string, int, std::less<>, avl_balanced> tree_loaded;
+        tree_loaded.load("tree_names.bst");				//balanced in O(n), no insert
+        std::remove("tree_names.bst");
+        std::cout << "Loaded tree :" << tree_loaded << std::endl;
+        std::cout << "Is the tree balanced?" << std::endl;
+        tree_loaded.check_balance() ? std::cout << "true" << std::endl : std::cout << "false" << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "A tree in a memory mapped file, reopened without loading" << std::endl;
+        {
+            MappedBst<int, double> tree_mapped{"tree_mapped.map"};
+            for(int i = 1; i <= 10; i++)
+                tree_mapped.insert({i, i / 2.0});
+            tree_mapped.erase(7);
+            tree_mapped.sync();
+        }
+        {
+            MappedBst<int, double> tree_mapped{"tree_mapped.map"};	//only maps the file
+            std::cout << "Reopened tree :" << tree_mapped << std::endl;
+            std::cout << "Size :" << tree_mapped.size() << ", height :" << tree_mapped.height() << std::endl;
+        }
+        std::remove("tree_mapped.map");
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "A tree whose changes are logged, recovered from its snapshot and log" << std::endl;
+        std::remove("tree_logged.bst");
+        std::remove("tree_logged.log");
+        {
+            LoggedBst<int, int> tree_logged{"tree_logged.bst", "tree_logged.log"};
+            for(int i = 1; i <= 5; i++)
+                tree_logged.insert({i,i});
+            tree_logged.checkpoint();						//1..5 in the snapshot
+            tree_logged.erase(2);
+            tree_logged.erase(42);							//missing: nothing erased, nothing logged
+            tree_logged[6] = 60;
+            tree_logged.insert_or_assign({1,10});
+        }                                                   //the changes after the checkpoint are in the log
+        {
+            LoggedBst<int, int> tree_logged{"tree_logged.bst", "tree_logged.log"};
+            std::cout << "Recovered tree :" << tree_logged << std::endl;
+            std::cout << "Changes replayed :" << tree_logged.recovered().records << std::endl;
+        }
+        std::remove("tree_logged.bst");
+        std::remove("tree_logged.log");
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "The shape of a tree: number of nodes at each depth" << std::endl;
+        Bst<int, int> tree_shape;
+        for(int i = 1; i <= 8; i++)
+            tree_shape.insert({i,i});
+        auto shape = tree_shape.stats();
+        std::cout << "Increasing keys, height " << shape.height << " :";
+        for(size_t d : shape.depths)
+            std::cout << " " << d;
+        std::cout << std::endl;
+        tree_shape.balance();
+        shape = tree_shape.stats();
+        std::cout << "Balanced, height " << shape.height << " :";
+        for(size_t d : shape.depths)
+            std::cout << " " << d;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "A threaded tree, iterated backwards" << std::endl;
+        Bst<int, int, std::less<int>, threaded<avl_balanced>> tree_threaded;
+        for(int i = 10; i >= 1; i--)
+            tree_threaded.insert({i,i});
+        tree_threaded.erase(4);
+        std::cout << "Reversed :";
+        for(auto it = tree_threaded.rbegin(); it != tree_threaded.rend(); ++it)
+            std::cout << " " << it->second;
+        std::cout << std::endl;
+        auto last = tree_threaded.end();
+        std::cout << "Last key :" << (*--last).first << ", before it :" << (*--last).first << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Order statistics" << std::endl;
+        Bst<int, int, std::less<int>, order_statistics<avl_balanced>> tree_rank;
+        for(int i = 1; i <= 20; i++)
+            tree_rank.insert({i*5, i*5});
+        tree_rank.erase(50);
+        std::cout << "Tree :" << tree_rank << std::endl;
+        std::cout << "Size :" << tree_rank.size() << std::endl;
+        std::cout << "Keys less than 42 :" << tree_rank.rank(42) << std::endl;
+        std::cout << "Median (key number " << tree_rank.size()/2 << ") :" << (*tree_rank.select(tree_rank.size()/2)).first << std::endl;
+        std::cout << "Keys in [20, 70) :" << tree_rank.count_range(20, 70) << std::endl;
+        std::cout << "Lower bound of 42 :" << (*tree_rank.lower_bound(42)).first << std::endl;
+        std::cout << "Upper bound of 45 :" << (*tree_rank.upper_bound(45)).first << std::endl;
+        std::cout << "Values in [20, 70) :";
+        tree_rank.for_each_in_range(20, 70, [](const std::pair<const int, int>& p){ std::cout << " " << p.second; });
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+        std::cout << "Split, join and set operations" << std::endl;
+        Bst<int, int, std::less<int>, avl_balanced> tree_left, tree_other;
+        for(int i = 1; i <= 10; i++){
+            tree_left.insert({i,i});
+            tree_other.insert({i*2,i*2});
+        }
+        auto tree_right = tree_left.split(6);
+        std::cout << "Keys less than 6 :" << tree_left << std::endl;
+        std::cout << "Keys from 6 on :" << tree_right << std::endl;
+        tree_left.join(std::move(tree_right));
+        std::cout << "Joined again :" << tree_left << std::endl;
+        tree_left.difference(std::move(tree_other));
+        std::cout << "Without the even keys :" << tree_left << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "Parallel traversal" << std::endl;
+        thread_pool pool{4};
+        tree_rank.parallel_for_each([](std::pair<const int, int>& x){ x.second *= 2; }, pool);
+        std::cout << "Doubled values :" << tree_rank << std::endl;
+        std::cout << "Sum of the values :" << tree_rank.parallel_reduce(0, [](const std::pair<const int, int>& x){ return x.second; }, std::plus<int>(), pool) << std::endl;
+        std::cout << "Keys joined in order :" << tree_rank.parallel_reduce(std::string{}, [](const std::pair<const int, int>& x){ return std::to_string(x.first) + " "; }, 
+                                                                           [](std::string a, const std::string& b){ return a + b; }, pool) << std::endl;
+        std::cout << std::endl;
+        std::cout << std::endl;
+
         std::cout << "3. ERASE" << std::endl;
         std::cout << "Erase the keys in a tree " << std::endl;
         std::cout << "Considering the given example tree " << std::endl;
@@ -149,6 +477,72 @@ int main(){
         std::cout << tree << std::endl;
         std::cout << std::endl;
 
+        std::cout << "*********************************" << std::endl;
+        std::cout << "Using a pool allocator for the nodes" << std::endl;
+        Bst<int, int, std::less<int>, avl_balanced, pool_allocator<std::pair<const int, int>>> tree_pool;
+        for(int i = 0; i < 10; i++)
+            tree_pool.insert({i,i});
+        tree_pool.erase(3);
+        tree_pool.erase(7);
+        tree_pool.insert({30,30});			//reuses a node freed by erase
+        std::cout << "Pool tree :" << tree_pool << std::endl;
+        tree_pool.clear();					//frees the blocks of the pool at once
+        for(int i = 0; i < 5; i++)
+            tree_pool.insert({i,i});
+        auto tree_pool_moved = std::move(tree_pool);
+        tree_pool.insert({42,42});			//the moved-from tree keeps a usable allocator
+        std::cout << "Moved to :" << tree_pool_moved << ", moved-from tree reused :" << tree_pool << std::endl;
+        tree_pool_moved.clear();			//node 42 of the other tree lives in the pool: freed one by one
+        std::cout << "Moved-to tree cleared, the moved-from tree still holds :" << tree_pool << std::endl;
+        using int_pool = pool_allocator<std::pair<const int, int>>;
+        int_pool shared_pool;
+        Bst<int, int, std::less<int>, avl_balanced, int_pool> tree_pool_a{shared_pool}, tree_pool_b{shared_pool};
+        tree_pool_a.insert({1,1});
+        tree_pool_a.insert({2,2});
+        std::cout << "Trees built from the same allocator share its pool? " 
+                  << (tree_pool_a.get_allocator() == tree_pool_b.get_allocator() ? "true" : "false") << std::endl;
+        tree_pool_b.insert(tree_pool_a.extract(2));	//so a node moves between them as it is
+        std::cout << "Node 2 moved :" << tree_pool_a << " " << tree_pool_b << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "*********************************" << std::endl;
+        std::cout << "Freezing a tree for read-only lookups" << std::endl;
+        FrozenBst<int, int, std::greater<int>> frozen{tree_greater};
+        std::cout << "Frozen tree :" << frozen << std::endl;
+        std::cout << "Find 38 :" << (*frozen.find(38)).second << std::endl;
+        std::cout << "Lower bound of 17 :" << (*frozen.lower_bound(17)).second << std::endl;
+        std::cout << "Is 17 in the tree? " << (frozen.find(17) != frozen.end() ? "true" : "false") << std::endl;
+        std::vector<std::pair<int, int>> frozen_pairs{{1,10}, {2,20}, {3,30}, {5,50}, {8,80}};
+        FrozenBst<int, int> frozen_from_pairs{frozen_pairs.begin(), frozen_pairs.end()};
+        std::cout << "Frozen from a vector of pairs :" << frozen_from_pairs << ", find 5 :" << (*frozen_from_pairs.find(5)).second << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "*********************************" << std::endl;
+        std::cout << "A tree with wide nodes" << std::endl;
+        WideBst<int, int> tree_wide;
+        for(int i = 100; i > 0; i--)
+            tree_wide.insert({i,i});
+        for(int i = 1; i <= 90; i++)
+            tree_wide.erase(i);
+        tree_wide[200] = 200;
+        std::cout << "Wide tree :" << tree_wide << std::endl;
+        std::cout << "Find 95 :" << (*tree_wide.find(95)).second << std::endl;
+        std::cout << std::endl;
+
+        std::cout << "*********************************" << std::endl;
+        std::cout << "Snapshots of a persistent tree" << std::endl;
+        PersistentBst<int, int> tree_persistent;
+        for(int i = 1; i <= 10; i++)
+            tree_persistent.insert({i,i});
+        auto version = tree_persistent.snapshot();      //O(1), shares all the nodes
+        tree_persistent.erase(5);
+        tree_persistent.insert({11,11});
+        tree_persistent.insert_or_assign({1,100});
+        std::cout << "Current version :" << tree_persistent << std::endl;
+        std::cout << "Snapshot :" << version << std::endl;
+        std::cout << "Is 5 in the snapshot? " << (version.find(5) != version.end() ? "true" : "false") << std::endl;
+        std::cout << std::endl;
+
         std::cout << "*********************************" << std::endl;
         std::cout << "Using the operator[]" << std::endl;
         Bst<double, double, std::less<double>> another_tree{9.1,9.1};